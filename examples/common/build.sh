@@ -0,0 +1 @@
+gcc -O2 -Wall -Wextra -o plp_sink_dump plp_sink_dump.c
@@ -0,0 +1,377 @@
+// Streaming output sink shared by the examples. Rows are staged column-wise
+// and written as self-describing blocks, so a reader can mmap the file and
+// use the columns in place (zero-copy). Three modes:
+//   PLP_SINK_BINARY  blocks through a buffered write(2)
+//   PLP_SINK_MMAP    blocks copied into a growing shared mapping of the file
+//   PLP_SINK_TEXT    one formatted line per row (slow; for debugging)
+//
+// File layout (native-endian, every offset 8-byte aligned):
+//   PlpSinkHeader, then blocks back to back. Each block is a PlpBlockHdr and
+//   its columns at col[k] bytes from the block start:
+//     PLP_REC_MODEL  input f64, output f64, coherence f64
+//     PLP_REC_PHENO  score f64, visits u64, id u32, qual u32, token u32, meta u32,
+//                    heap. token/meta are offsets of NUL-terminated strings in
+//                    heap; a meta of PLP_SINK_NULL means none.
+// Blocks of different kinds are flushed independently, so row order is only
+// kept within a kind.
+#ifndef PLP_SINK_H
+#define PLP_SINK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PLP_SINK_MAGIC      "PLPSINK1"
+#define PLP_SINK_BLOCK_MAGIC "PLPB"
+#define PLP_SINK_ENDIAN     0x01020304u
+#define PLP_SINK_BLOCK_ROWS 4096
+#define PLP_SINK_MAX_COLS   8
+#define PLP_SINK_NULL       UINT32_MAX
+#define PLP_SINK_BUF        (1u << 20)    // write buffer, binary mode
+#define PLP_SINK_EXTENT     (64u << 20)   // mapping growth step, mmap mode
+
+typedef enum { PLP_SINK_BINARY, PLP_SINK_MMAP, PLP_SINK_TEXT } PlpSinkMode;
+typedef enum { PLP_REC_MODEL = 1, PLP_REC_PHENO = 2 } PlpRecKind;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;   // PLP_SINK_ENDIAN as written by the producer
+} PlpSinkHeader;
+
+typedef struct {
+    char magic[4];
+    uint32_t kind;
+    uint32_t rows;
+    uint32_t ncols;
+    uint64_t bytes;   // whole block, header included
+    uint64_t col[PLP_SINK_MAX_COLS];
+} PlpBlockHdr;
+
+typedef struct {
+    double *input, *output, *coherence;
+    uint32_t rows;
+} PlpModelStage;
+
+typedef struct {
+    double *score;
+    uint64_t *visits;
+    uint32_t *id, *qual, *token, *meta;
+    char *heap;
+    size_t heap_len, heap_cap;
+    uint32_t rows;
+} PlpPhenoStage;
+
+typedef struct {
+    PlpSinkMode mode;
+    int fd;
+    FILE *text;
+    int err;
+    char *buf;          // binary: pending bytes; mmap: the mapping
+    size_t len, cap;    // bytes used / available in buf
+    PlpModelStage model;
+    PlpPhenoStage pheno;
+} PlpSink;
+
+static inline size_t plp_sink_round(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static inline void *plp_sink_xalloc(size_t n) {
+    void *p = malloc(n);
+    if (!p) { perror("malloc"); exit(1); }
+    return p;
+}
+
+// Binary mode: writes out the buffered bytes; returns 0 on an I/O error.
+static inline int plp_sink_drain(PlpSink *s) {
+    size_t off = 0;
+    while (off < s->len) {
+        ssize_t w = write(s->fd, s->buf + off, s->len - off);
+        if (w <= 0) { s->err = 1; return 0; }
+        off += (size_t)w;
+    }
+    s->len = 0;
+    return 1;
+}
+
+// Makes room for n more bytes at buf + len; returns 0 on an I/O error, and
+// on every call after one, so a sink that failed once drops all later data.
+static inline int plp_sink_reserve(PlpSink *s, size_t n) {
+    if (s->err) return 0;
+    if (s->len + n <= s->cap) return 1;
+    if (s->mode == PLP_SINK_BINARY) {
+        if (!plp_sink_drain(s)) return 0;
+        if (n > s->cap) {   // a block bigger than the buffer
+            free(s->buf);
+            s->cap = plp_sink_round(n);
+            s->buf = plp_sink_xalloc(s->cap);
+        }
+        return 1;
+    }
+    size_t cap = s->cap;
+    while (cap < s->len + n) cap += PLP_SINK_EXTENT;
+    // the old mapping stays in place until the larger one exists
+    if (ftruncate(s->fd, (off_t)cap) != 0) { s->err = 1; return 0; }
+    void *map = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (map == MAP_FAILED) { s->err = 1; return 0; }
+    if (s->buf && munmap(s->buf, s->cap) != 0) s->err = 1;
+    s->buf = map;
+    s->cap = cap;
+    return 1;
+}
+
+static inline void plp_sink_put(PlpSink *s, const void *p, size_t n) {
+    if (!plp_sink_reserve(s, n)) return;
+    memcpy(s->buf + s->len, p, n);
+    s->len += n;
+}
+
+// Appends one block whose columns are given as (pointer, bytes) pairs.
+static inline void plp_sink_block(PlpSink *s, uint32_t kind, uint32_t rows,
+                                  const void *const *col, const size_t *len, uint32_t ncols) {
+    PlpBlockHdr h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PLP_SINK_BLOCK_MAGIC, 4);
+    h.kind = kind;
+    h.rows = rows;
+    h.ncols = ncols;
+    size_t at = plp_sink_round(sizeof(h));
+    for (uint32_t k = 0; k < ncols; ++k) { h.col[k] = at; at += plp_sink_round(len[k]); }
+    h.bytes = at;
+    if (!plp_sink_reserve(s, at)) return;
+    char *dst = s->buf + s->len;
+    memset(dst, 0, at);
+    memcpy(dst, &h, sizeof(h));
+    for (uint32_t k = 0; k < ncols; ++k) memcpy(dst + h.col[k], col[k], len[k]);
+    s->len += at;
+}
+
+static inline void plp_sink_flush_model(PlpSink *s) {
+    PlpModelStage *m = &s->model;
+    if (!m->rows) return;
+    size_t b = m->rows * sizeof(double);
+    const void *col[] = { m->input, m->output, m->coherence };
+    size_t len[] = { b, b, b };
+    plp_sink_block(s, PLP_REC_MODEL, m->rows, col, len, 3);
+    m->rows = 0;
+}
+
+static inline void plp_sink_flush_pheno(PlpSink *s) {
+    PlpPhenoStage *p = &s->pheno;
+    if (!p->rows) return;
+    size_t r = p->rows;
+    const void *col[] = { p->score, p->visits, p->id, p->qual, p->token, p->meta, p->heap };
+    size_t len[] = { r * 8, r * 8, r * 4, r * 4, r * 4, r * 4, p->heap_len };
+    plp_sink_block(s, PLP_REC_PHENO, p->rows, col, len, 7);
+    p->rows = 0;
+    p->heap_len = 0;
+}
+
+// path "-" writes text to stdout; it is rejected (EINVAL) for the binary
+// modes rather than creating a file named "-". Returns NULL if the file
+// cannot be opened.
+static inline PlpSink *plp_sink_open(const char *path, PlpSinkMode mode) {
+    if (mode != PLP_SINK_TEXT && strcmp(path, "-") == 0) { errno = EINVAL; return NULL; }
+    PlpSink *s = calloc(1, sizeof(PlpSink));
+    if (!s) { perror("calloc"); exit(1); }
+    s->mode = mode;
+    s->fd = -1;
+    if (mode == PLP_SINK_TEXT) {
+        s->text = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+        if (!s->text) { free(s); return NULL; }
+        return s;
+    }
+    s->fd = open(path, mode == PLP_SINK_MMAP ? O_RDWR | O_CREAT | O_TRUNC : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (s->fd < 0) { free(s); return NULL; }
+    if (mode == PLP_SINK_BINARY) { s->cap = PLP_SINK_BUF; s->buf = plp_sink_xalloc(s->cap); }
+    PlpSinkHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PLP_SINK_MAGIC, 8);
+    h.version = 1;
+    h.endian = PLP_SINK_ENDIAN;
+    plp_sink_put(s, &h, sizeof(h));
+    PlpModelStage *m = &s->model;
+    m->input = plp_sink_xalloc(PLP_SINK_BLOCK_ROWS * sizeof(double));
+    m->output = plp_sink_xalloc(PLP_SINK_BLOCK_ROWS * sizeof(double));
+    m->coherence = plp_sink_xalloc(PLP_SINK_BLOCK_ROWS * sizeof(double));
+    PlpPhenoStage *p = &s->pheno;
+    p->score = plp_sink_xalloc(PLP_SINK_BLOCK_ROWS * sizeof(double));
+    p->visits = plp_sink_xalloc(PLP_SINK_BLOCK_ROWS * sizeof(uint64_t));
+    p->id = plp_sink_xalloc(PLP_SINK_BLOCK_ROWS * sizeof(uint32_t));
+    p->qual = plp_sink_xalloc(PLP_SINK_BLOCK_ROWS * sizeof(uint32_t));
+    p->token = plp_sink_xalloc(PLP_SINK_BLOCK_ROWS * sizeof(uint32_t));
+    p->meta = plp_sink_xalloc(PLP_SINK_BLOCK_ROWS * sizeof(uint32_t));
+    return s;
+}
+
+// Columnar append of n model samples.
+static inline void plp_sink_models(PlpSink *s, const double *input, const double *output,
+                                   const double *coherence, size_t n) {
+    if (s->mode == PLP_SINK_TEXT) {
+        for (size_t i = 0; i < n; ++i)
+            fprintf(s->text, "x = %+.2f | f(x) = %+.3f | coherence = %.3f\n", input[i], output[i], coherence[i]);
+        return;
+    }
+    PlpModelStage *m = &s->model;
+    while (n) {
+        size_t k = PLP_SINK_BLOCK_ROWS - m->rows;
+        if (k > n) k = n;
+        memcpy(m->input + m->rows, input, k * sizeof(double));
+        memcpy(m->output + m->rows, output, k * sizeof(double));
+        memcpy(m->coherence + m->rows, coherence, k * sizeof(double));
+        m->rows += (uint32_t)k;
+        input += k; output += k; coherence += k; n -= k;
+        if (m->rows == PLP_SINK_BLOCK_ROWS) plp_sink_flush_model(s);
+    }
+}
+
+static inline void plp_sink_model(PlpSink *s, double input, double output, double coherence) {
+    plp_sink_models(s, &input, &output, &coherence, 1);
+}
+
+static inline uint32_t plp_sink_str(PlpPhenoStage *p, const char *str) {
+    size_t n = strlen(str) + 1;
+    if (p->heap_len + n > p->heap_cap) {
+        while (p->heap_len + n > p->heap_cap) p->heap_cap = p->heap_cap ? p->heap_cap * 2 : 64 * 1024;
+        p->heap = realloc(p->heap, p->heap_cap);
+        if (!p->heap) { perror("realloc"); exit(1); }
+    }
+    memcpy(p->heap + p->heap_len, str, n);
+    p->heap_len += n;
+    return (uint32_t)(p->heap_len - n);
+}
+
+// One phenotype row; meta may be NULL.
+static inline void plp_sink_pheno(PlpSink *s, const char *token, double score, uint64_t visits,
+                                  uint32_t qual, uint32_t id, const char *meta) {
+    if (s->mode == PLP_SINK_TEXT) {
+        fprintf(s->text, "token='%s' score=%.3f visits=%" PRIu64 " qual=0x%x meta=%s\n",
+                token, score, visits, qual, meta ? meta : "NULL");
+        return;
+    }
+    PlpPhenoStage *p = &s->pheno;
+    if (p->heap_len > UINT32_MAX / 2) plp_sink_flush_pheno(s);   // keep heap offsets in range
+    uint32_t r = p->rows;
+    p->score[r] = score;
+    p->visits[r] = visits;
+    p->id[r] = id;
+    p->qual[r] = qual;
+    p->token[r] = plp_sink_str(p, token);
+    p->meta[r] = meta ? plp_sink_str(p, meta) : PLP_SINK_NULL;
+    if (++p->rows == PLP_SINK_BLOCK_ROWS) plp_sink_flush_pheno(s);
+}
+
+// Flushes pending rows and closes the file; returns -1 if any write failed.
+static inline int plp_sink_close(PlpSink *s) {
+    int rc = 0;
+    if (s->mode == PLP_SINK_TEXT) {
+        if (s->text != stdout) rc = fclose(s->text);
+        else rc = fflush(stdout);
+        free(s);
+        return rc ? -1 : 0;
+    }
+    plp_sink_flush_model(s);
+    plp_sink_flush_pheno(s);
+    if (s->mode == PLP_SINK_BINARY) {
+        plp_sink_drain(s);
+        free(s->buf);
+    } else {
+        if (s->buf && munmap(s->buf, s->cap) != 0) s->err = 1;
+        if (ftruncate(s->fd, (off_t)s->len) != 0) s->err = 1;
+    }
+    if (close(s->fd) != 0) s->err = 1;
+    rc = s->err ? -1 : 0;
+    free(s->model.input); free(s->model.output); free(s->model.coherence);
+    free(s->pheno.score); free(s->pheno.visits); free(s->pheno.id); free(s->pheno.qual);
+    free(s->pheno.token); free(s->pheno.meta); free(s->pheno.heap);
+    free(s);
+    return rc;
+}
+
+// --------------------- Reader ---------------------
+// Maps a sink file read-only. Blocks are walked with plp_sink_next() and their
+// columns are used in place through plp_block_col().
+typedef struct {
+    const char *base;
+    size_t size;
+} PlpSinkMap;
+
+static inline int plp_sink_map(const char *path, PlpSinkMap *m) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PlpSinkHeader)) { close(fd); return -1; }
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return -1;
+    const PlpSinkHeader *h = p;
+    if (memcmp(h->magic, PLP_SINK_MAGIC, 8) != 0 || h->endian != PLP_SINK_ENDIAN) {
+        munmap(p, (size_t)st.st_size);
+        return -1;
+    }
+    m->base = p;
+    m->size = (size_t)st.st_size;
+    return 0;
+}
+
+static inline void plp_sink_unmap(PlpSinkMap *m) {
+    if (m->base) munmap((void *)m->base, m->size);
+    m->base = NULL;
+}
+
+// Column layout of a block: every column 8-byte aligned inside the block and,
+// for the known kinds, the expected count and rows * width bytes each (0: the
+// string heap, which runs to the end of the block). Other kinds are only
+// bounds-checked, so readers can skip them.
+static inline int plp_block_ok(const PlpBlockHdr *b) {
+    static const uint8_t model[] = { 8, 8, 8 }, pheno[] = { 8, 8, 4, 4, 4, 4, 0 };
+    const uint8_t *width = NULL;
+    if (b->kind == PLP_REC_MODEL) {
+        if (b->ncols != 3) return 0;
+        width = model;
+    } else if (b->kind == PLP_REC_PHENO) {
+        if (b->ncols != 7) return 0;
+        width = pheno;
+    }
+    if (b->bytes & 7) return 0;
+    for (uint32_t k = 0; k < b->ncols; ++k) {
+        uint64_t col = b->col[k];
+        if ((col & 7) || col < plp_sink_round(sizeof(PlpBlockHdr)) || col > b->bytes) return 0;
+        if (width && width[k] && (b->bytes - col) / width[k] < b->rows) return 0;
+    }
+    return 1;
+}
+
+// Block at *off (start with 0) or NULL at the end or on a malformed block;
+// advances *off past it.
+static inline const PlpBlockHdr *plp_sink_next(const PlpSinkMap *m, size_t *off) {
+    if (*off == 0) *off = plp_sink_round(sizeof(PlpSinkHeader));
+    if (*off + sizeof(PlpBlockHdr) > m->size) return NULL;
+    const PlpBlockHdr *b = (const PlpBlockHdr *)(m->base + *off);
+    if (memcmp(b->magic, PLP_SINK_BLOCK_MAGIC, 4) != 0 || b->bytes < sizeof(PlpBlockHdr) || b->bytes > m->size - *off ||
+        b->ncols > PLP_SINK_MAX_COLS || !plp_block_ok(b))
+        return NULL;
+    *off += b->bytes;
+    return b;
+}
+
+static inline const void *plp_block_col(const PlpBlockHdr *b, uint32_t k) {
+    return (const char *)b + b->col[k];
+}
+
+// String at offset off of heap column k, or NULL unless off lies inside the
+// heap and a NUL follows it before the block ends.
+static inline const char *plp_block_str(const PlpBlockHdr *b, uint32_t k, uint32_t off) {
+    const char *heap = plp_block_col(b, k);
+    size_t len = b->bytes - b->col[k];
+    if (off >= len || !memchr(heap + off, '\0', len - off)) return NULL;
+    return heap + off;
+}
+
+#endif
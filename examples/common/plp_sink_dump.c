@@ -0,0 +1,39 @@
+// Prints a plp_sink file as text (the same lines PLP_SINK_TEXT writes), reading
+// the columns straight from a read-only mapping.
+//   ./plp_sink_dump file.plp [-s]    -s: per-kind row counts only
+#include "plp_sink.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2) { fprintf(stderr, "usage: %s file.plp [-s]\n", argv[0]); return 2; }
+    int summary = argc > 2 && strcmp(argv[2], "-s") == 0;
+    PlpSinkMap m;
+    if (plp_sink_map(argv[1], &m) != 0) { fprintf(stderr, "%s: not a plp_sink file\n", argv[1]); return 1; }
+    size_t off = 0, models = 0, phenos = 0, blocks = 0;
+    int bad = 0;
+    const PlpBlockHdr *b;
+    while (!bad && (b = plp_sink_next(&m, &off))) {
+        ++blocks;
+        if (b->kind == PLP_REC_MODEL) {
+            const double *in = plp_block_col(b, 0), *out = plp_block_col(b, 1), *coh = plp_block_col(b, 2);
+            for (uint32_t i = 0; i < b->rows && !summary; ++i)
+                printf("x = %+.2f | f(x) = %+.3f | coherence = %.3f\n", in[i], out[i], coh[i]);
+            models += b->rows;
+        } else if (b->kind == PLP_REC_PHENO) {
+            const double *score = plp_block_col(b, 0);
+            const uint64_t *visits = plp_block_col(b, 1);
+            const uint32_t *qual = plp_block_col(b, 3), *token = plp_block_col(b, 4), *meta = plp_block_col(b, 5);
+            for (uint32_t i = 0; i < b->rows && !summary; ++i) {
+                const char *tok = plp_block_str(b, 6, token[i]);
+                const char *met = meta[i] == PLP_SINK_NULL ? "NULL" : plp_block_str(b, 6, meta[i]);
+                if (!tok || !met) { off -= b->bytes; bad = 1; break; }   // report the block as malformed
+                printf("token='%s' score=%.3f visits=%" PRIu64 " qual=0x%x meta=%s\n", tok, score[i],
+                       visits[i], qual[i], met);
+            }
+            if (!bad) phenos += b->rows;
+        }
+    }
+    if (off != m.size) fprintf(stderr, "%s: trailing or malformed data at offset %zu\n", argv[1], off);
+    if (summary) printf("%zu blocks | %zu model rows | %zu phenotype rows\n", blocks, models, phenos);
+    plp_sink_unmap(&m);
+    return off == m.size ? 0 : 1;
+}
@@ -1 +1 @@
-gcc -o plp_function_model plp_function_model.c -lm
+gcc -O2 -o plp_function_model plp_function_model.c -lm -pthread
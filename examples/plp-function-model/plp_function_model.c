@@ -1,5 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "../common/plp_sink.h"
 
 // Example: phenomenological lensing protocol (PLP) inspired function modeling
 // MVP idea: treat each function as an observable system with local state and coherence feedback.
@@ -17,23 +28,1399 @@ double f(double x) {
     return sin(x) + log(fabs(x) + 1.0);
 }
 
+// toy coherence metric: high if input/output ratio is stable
+static double coherence_of(double x, double y) {
+    double ratio = fabs(y / (x + 1e-6));
+    return exp(-fabs(ratio - 1.0)); // decays as behavior diverges
+}
+
 // PLP wrapper: measures coherence between input and modeled output
 PLP_Model plp_observe(double x) {
     PLP_Model m;
     m.input = x;
     m.output = f(x);
+    m.coherence = coherence_of(x, m.output);
+    return m;
+}
+
+// --------------------- Vector kernels ---------------------
+// sin/log/exp on four doubles (Cephes/fdlibm polynomials, within a few ulp of
+// libm) for the AVX2 batch path, which is picked at runtime.
+#if defined(__x86_64__) || defined(__i386__)
+#define PLP_AVX2 __attribute__((target("avx2,fma")))
+
+// Polynomial c[0]*z^k + ... + c[k] by Horner's rule.
+PLP_AVX2 static __m256d poly_avx2(__m256d z, const double *c, int k) {
+    __m256d p = _mm256_set1_pd(c[0]);
+    for (int i = 1; i <= k; ++i) p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(c[i]));
+    return p;
+}
+
+// Cephes sin: reduce to octant j of pi/4 with a three-part pi/4, then the sin
+// or cos polynomial depending on j.
+PLP_AVX2 static __m256d sin_avx2(__m256d x) {
+    static const double sincof[] = {
+        1.58962301576546568060E-10, -2.50507477628578072866E-8, 2.75573136213857245213E-6,
+        -1.98412698295895385996E-4, 8.33333333332211858878E-3, -1.66666666666666307295E-1,
+    };
+    static const double coscof[] = {
+        -1.13585365213876817300E-11, 2.08757008419747316778E-9, -2.75573141792967388112E-7,
+        2.48015872888517045348E-5, -1.38888888888730564116E-3, 4.16666666666665929218E-2,
+    };
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d ax = _mm256_andnot_pd(sign, x);
+    __m128i j = _mm256_cvttpd_epi32(_mm256_mul_pd(ax, _mm256_set1_pd(1.27323954473516268615)));   // 4/pi
+    j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+    __m256d y = _mm256_cvtepi32_pd(j);
+    __m256d z = _mm256_fnmadd_pd(y, _mm256_set1_pd(7.85398125648498535156E-1), ax);
+    z = _mm256_fnmadd_pd(y, _mm256_set1_pd(3.77489470793079817668E-8), z);
+    z = _mm256_fnmadd_pd(y, _mm256_set1_pd(2.69515142907905952645E-15), z);
+    __m256d zz = _mm256_mul_pd(z, z);
+    __m256d s = _mm256_fmadd_pd(_mm256_mul_pd(z, zz), poly_avx2(zz, sincof, 5), z);
+    __m256d c = _mm256_fmadd_pd(_mm256_mul_pd(zz, zz), poly_avx2(zz, coscof, 5),
+                                _mm256_fnmadd_pd(_mm256_set1_pd(0.5), zz, _mm256_set1_pd(1.0)));
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d use_cos = _mm256_cmp_pd(_mm256_cvtepi32_pd(_mm_and_si128(j, _mm_set1_epi32(2))), zero, _CMP_NEQ_OQ);
+    __m256d flip = _mm256_cmp_pd(_mm256_cvtepi32_pd(_mm_and_si128(j, _mm_set1_epi32(4))), zero, _CMP_NEQ_OQ);
+    __m256d r = _mm256_blendv_pd(s, c, use_cos);
+    __m256d neg = _mm256_xor_pd(_mm256_and_pd(flip, sign), _mm256_and_pd(x, sign));
+    return _mm256_xor_pd(r, neg);
+}
+
+// fdlibm log for finite x >= 1: x = 2^e * m with m in [sqrt(2)/2, sqrt(2)),
+// log(m) from s = (m-1)/(m+1).
+PLP_AVX2 static __m256d log_avx2(__m256d x) {
+    static const double lg[] = {
+        1.479819860511658591e-01, 1.531383769920937332e-01, 1.818357216161805012e-01,
+        2.222219843214978396e-01, 2.857142874366239149e-01, 3.999999999940941908e-01,
+        6.666666666666735130e-01,
+    };
+    __m256i bits = _mm256_castpd_si256(x);
+    __m256i e = _mm256_sub_epi64(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(1023));
+    __m256i mant = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFll)),
+                                   _mm256_set1_epi64x(0x3FF0000000000000ll));
+    __m256d m = _mm256_castsi256_pd(mant);   // [1, 2)
+    __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(1.41421356237309504880), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+    e = _mm256_sub_epi64(e, _mm256_castpd_si256(big));   // big lanes are all ones, i.e. -1
+    // e fits in 32 bits: gather the low halves of each lane for the conversion
+    __m128i e32 = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(e, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+    __m256d ed = _mm256_cvtepi32_pd(e32);
+    __m256d fm = _mm256_sub_pd(m, _mm256_set1_pd(1.0));
+    __m256d s = _mm256_div_pd(fm, _mm256_add_pd(fm, _mm256_set1_pd(2.0)));
+    __m256d z = _mm256_mul_pd(s, s);
+    __m256d r = _mm256_mul_pd(z, poly_avx2(z, lg, 6));
+    __m256d hfsq = _mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_mul_pd(fm, fm));
+    __m256d lo = _mm256_fmadd_pd(ed, _mm256_set1_pd(1.90821492927058770002e-10),
+                                 _mm256_mul_pd(s, _mm256_add_pd(hfsq, r)));
+    __m256d v = _mm256_add_pd(_mm256_sub_pd(fm, hfsq), lo);
+    return _mm256_fmadd_pd(ed, _mm256_set1_pd(6.93147180369123816490e-01), v);
+}
+
+// exp(x) = 2^n * exp(r), |r| <= ln2/2, with a degree-13 Taylor polynomial.
+// Results below DBL_MIN (x < -708.39) are flushed to zero; x > 709.78 gives inf.
+PLP_AVX2 static __m256d exp_avx2(__m256d x) {
+    static const double ec[] = {
+        1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0,
+        1.0 / 40320.0, 1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5, 1.0, 1.0,
+    };
+    __m256d under = _mm256_cmp_pd(x, _mm256_set1_pd(-708.39), _CMP_LT_OQ);
+    __m256d over = _mm256_cmp_pd(x, _mm256_set1_pd(709.78), _CMP_GT_OQ);
+    __m256d xc = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(-708.39)), _mm256_set1_pd(709.78));
+    __m256d n = _mm256_round_pd(_mm256_mul_pd(xc, _mm256_set1_pd(1.44269504088896340736)),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(6.93145751953125E-1), xc);
+    r = _mm256_fnmadd_pd(n, _mm256_set1_pd(1.42860682030941723212E-6), r);
+    __m256d p = poly_avx2(r, ec, 13);
+    // 2^n: n + 2^52 + 2^51 leaves n in the low mantissa bits
+    const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+    __m256i ni = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(n, magic)), _mm256_castpd_si256(magic));
+    __m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(ni, _mm256_set1_epi64x(1023)), 52));
+    __m256d v = _mm256_mul_pd(p, scale);
+    v = _mm256_andnot_pd(under, v);
+    return _mm256_blendv_pd(v, _mm256_set1_pd(INFINITY), over);
+}
+#endif
+
+// --------------------- Observed functions ---------------------
+// Each model is a scalar kernel model_<name>(x) and, on x86, a vector kernel
+// model_<name>_v computing the same on four lanes. Listing a model in
+// PLP_FUNCTIONS stamps out its batch loops, with the kernels inlined, and adds
+// it to the registry that plp_function_find() searches by name.
+static double model_sinlog(double x) { return f(x); }
+static double model_damped(double x) { return exp(-0.25 * fabs(x)) * sin(x); }
+static double model_logistic(double x) { return 1.0 / (1.0 + exp(-x)); }
+static double model_cubic(double x) { return x * x * x - x; }
+
+#if defined(__x86_64__) || defined(__i386__)
+PLP_AVX2 static __m256d model_sinlog_v(__m256d x) {
+    __m256d ax = _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+    return _mm256_add_pd(sin_avx2(x), log_avx2(_mm256_add_pd(ax, _mm256_set1_pd(1.0))));
+}
+
+PLP_AVX2 static __m256d model_damped_v(__m256d x) {
+    __m256d nax = _mm256_or_pd(x, _mm256_set1_pd(-0.0));   // -|x|
+    return _mm256_mul_pd(exp_avx2(_mm256_mul_pd(nax, _mm256_set1_pd(0.25))), sin_avx2(x));
+}
+
+PLP_AVX2 static __m256d model_logistic_v(__m256d x) {
+    __m256d e = exp_avx2(_mm256_xor_pd(x, _mm256_set1_pd(-0.0)));
+    return _mm256_div_pd(_mm256_set1_pd(1.0), _mm256_add_pd(_mm256_set1_pd(1.0), e));
+}
+
+PLP_AVX2 static __m256d model_cubic_v(__m256d x) {
+    return _mm256_fmsub_pd(_mm256_mul_pd(x, x), x, x);
+}
+#endif
+
+//   X(name, description)
+#define PLP_FUNCTIONS(X) \
+    X(sinlog,   "sin(x) + log(|x| + 1), the default f") \
+    X(damped,   "exp(-|x|/4) * sin(x)") \
+    X(logistic, "1 / (1 + exp(-x))") \
+    X(cubic,    "x^3 - x")
+
+// --------------------- Batch observation ---------------------
+// plp_observe over arrays: out[i] = model(xs[i]) and coh[i] is its coherence.
+// The loops are templates: they are always inlined into the per-model
+// functions generated below with a constant kernel, so each of those has its
+// model inlined and makes no call per sample. On the AVX2 path, groups holding a
+// non-finite input or |x| >= 2^30 (beyond the sin reduction's range) use the
+// scalar kernel.
+typedef void (*observe_fn)(const double *xs, size_t n, double *out, double *coh);
+
+#define PLP_INLINE inline __attribute__((always_inline))
+
+static PLP_INLINE void observe_loop(const double *xs, size_t n, double *out, double *coh,
+                                    double (*model)(double)) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = model(xs[i]);
+        coh[i] = coherence_of(xs[i], out[i]);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+PLP_AVX2 static PLP_INLINE void observe_loop_avx2(const double *xs, size_t n, double *out, double *coh,
+                                                  double (*model)(double), __m256d (*vmodel)(__m256d)) {
+    const __m256d sign = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0);
+    const __m256d limit = _mm256_set1_pd(1073741824.0);   // 2^30, also rejects inf and NaN
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(xs + i);
+        if (_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, x), limit, _CMP_LT_OQ)) != 0xF) {
+            observe_loop(xs + i, 4, out + i, coh + i, model);
+            continue;
+        }
+        __m256d y = vmodel(x);
+        __m256d ratio = _mm256_andnot_pd(sign, _mm256_div_pd(y, _mm256_add_pd(x, _mm256_set1_pd(1e-6))));
+        __m256d d = _mm256_or_pd(_mm256_sub_pd(ratio, one), sign);   // -|ratio - 1|
+        _mm256_storeu_pd(out + i, y);
+        _mm256_storeu_pd(coh + i, exp_avx2(d));
+    }
+    observe_loop(xs + i, n - i, out + i, coh + i, model);
+}
+
+#define PLP_BATCH_AVX2(name) \
+    PLP_AVX2 static void observe_##name##_avx2(const double *xs, size_t n, double *out, double *coh) { \
+        observe_loop_avx2(xs, n, out, coh, model_##name, model_##name##_v); \
+    }
+#define PLP_AVX2_ENTRY(name) observe_##name##_avx2
+#else
+#define PLP_BATCH_AVX2(name)
+#define PLP_AVX2_ENTRY(name) NULL
+#endif
+
+#define PLP_BATCH(name, desc) \
+    static void observe_##name##_scalar(const double *xs, size_t n, double *out, double *coh) { \
+        observe_loop(xs, n, out, coh, model_##name); \
+    } \
+    PLP_BATCH_AVX2(name)
+PLP_FUNCTIONS(PLP_BATCH)
 
-    // toy coherence metric: high if input/output ratio is stable
-    double ratio = fabs(m.output / (x + 1e-6));
-    m.coherence = exp(-fabs(ratio - 1.0)); // decays as behavior diverges
+typedef struct {
+    const char *name;
+    const char *desc;
+    double (*fn)(double);      // scalar model, for single observations
+    observe_fn batch_scalar;   // reference batch loop
+    observe_fn batch_avx2;     // NULL off x86
+} PLP_Function;
+
+#define PLP_ENTRY(name, desc) { #name, desc, model_##name, observe_##name##_scalar, PLP_AVX2_ENTRY(name) },
+static const PLP_Function plp_functions[] = { PLP_FUNCTIONS(PLP_ENTRY) };
+#define PLP_NFUNCTIONS (sizeof(plp_functions) / sizeof(plp_functions[0]))
+
+// Registered model called name, or NULL.
+const PLP_Function* plp_function_find(const char *name) {
+    for (size_t i = 0; i < PLP_NFUNCTIONS; ++i)
+        if (strcmp(plp_functions[i].name, name) == 0) return &plp_functions[i];
+    return NULL;
+}
 
+static int have_avx2(void) {
+    static int state;   // 0 unknown, 1 no, 2 yes
+    int s = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    if (!s) {
+#if defined(__x86_64__) || defined(__i386__)
+        s = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? 2 : 1;
+#else
+        s = 1;
+#endif
+        __atomic_store_n(&state, s, __ATOMIC_RELAXED);
+    }
+    return s == 2;
+}
+
+PLP_Model plp_observe_with(const PLP_Function *fn, double x) {
+    PLP_Model m;
+    m.input = x;
+    m.output = fn->fn(x);
+    m.coherence = coherence_of(x, m.output);
     return m;
 }
 
-int main() {
+// One call through the table per batch, none per sample.
+void plp_observe_batch_with(const PLP_Function *fn, const double *xs, size_t n, double *out, double *coh) {
+    observe_fn k = fn->batch_avx2 && have_avx2() ? fn->batch_avx2 : fn->batch_scalar;
+    k(xs, n, out, coh);
+}
+
+// Batch form of plp_observe (the default f).
+void plp_observe_batch(const double *xs, size_t n, double *out, double *coh) {
+    plp_observe_batch_with(&plp_functions[0], xs, n, out, coh);
+}
+
+// Scalar reference for plp_observe_batch.
+void plp_observe_batch_scalar(const double *xs, size_t n, double *out, double *coh) {
+    observe_sinlog_scalar(xs, n, out, coh);
+}
+
+// --------------------- Approximation tier ---------------------
+// A PLP_Approx replaces a model's output and coherence over [lo, hi] by
+// piecewise cubics on uniform segments, for screening runs that can trade
+// precision for speed. Each cubic interpolates the exact path at the four
+// Chebyshev nodes of its segment, so no sin/log/exp is evaluated at all.
+// Segments are verified against the exact path at dense interior points; the
+// segment count is doubled until few fail, and the ones that still fail (the
+// kinks of |x| and of the coherence metric) are flagged and evaluated
+// exactly. A final check on pseudo-random samples flags any segment it
+// catches exceeding the bound. Inputs outside [lo, hi] take the exact path.
+// Errors are |dy| / max(|y|, 1) for the output and |dc| for coherence.
+#define PLP_APPROX_MIN_SEGMENTS 256
+#define PLP_APPROX_MAX_SEGMENTS (1u << 18)
+#define PLP_APPROX_VERIFY 16      // interior check points per segment
+#define PLP_APPROX_CHECK  (1u << 20)
+
+typedef struct {
+    const PLP_Function *fn;
+    double lo, hi, h, inv_h;
+    double max_err;
+    double checked_err;       // largest error seen by the final check
+    size_t nseg, nexact;      // segments / segments on the exact path
+    double *coef;             // per segment: output a0..a3, coherence a0..a3 in t in [-1, 1]
+    unsigned char *exact;
+} PLP_Approx;
+
+static double approx_err(double y, double c, double ry, double rc) {
+    double e = fabs(y - ry) / fmax(fabs(ry), 1.0);
+    double ec = fabs(c - rc);
+    if (!(e == e) || !(ec == ec)) return INFINITY;
+    return e > ec ? e : ec;
+}
+
+static PLP_INLINE double approx_horner(const double *a, double t) {
+    return ((a[3] * t + a[2]) * t + a[1]) * t + a[0];
+}
+
+// Chebyshev interpolation at the nodes cos((2j + 1) pi / 8), written out as
+// monomials in t.
+static void approx_fit(PLP_Approx *a, size_t k) {
+    double y[4], c[4], tn[4];
+    for (int j = 0; j < 4; ++j) {
+        tn[j] = cos((2 * j + 1) * M_PI / 8);
+        PLP_Model m = plp_observe_with(a->fn, a->lo + ((double)k + 0.5 * (tn[j] + 1)) * a->h);
+        y[j] = m.output;
+        c[j] = m.coherence;
+    }
+    for (int v = 0; v < 2; ++v) {
+        const double *f = v ? c : y;
+        double ch[4] = { 0, 0, 0, 0 };
+        for (int j = 0; j < 4; ++j) {
+            double t = tn[j], T[4] = { 1, t, 2 * t * t - 1, 4 * t * t * t - 3 * t };
+            for (int i = 0; i < 4; ++i) ch[i] += f[j] * T[i] / 2;
+        }
+        ch[0] /= 2;
+        double *out = a->coef + 8 * k + 4 * v;
+        out[0] = ch[0] - ch[2];
+        out[1] = ch[1] - 3 * ch[3];
+        out[2] = 2 * ch[2];
+        out[3] = 4 * ch[3];
+    }
+}
+
+// Approximation at x in segment k, local coordinate t.
+static PLP_INLINE void approx_eval(const PLP_Approx *a, size_t k, double t, double *y, double *c) {
+    *y = approx_horner(a->coef + 8 * k, t);
+    *c = approx_horner(a->coef + 8 * k + 4, t);
+}
+
+static int approx_segment_ok(const PLP_Approx *a, size_t k) {
+    for (int j = 0; j <= PLP_APPROX_VERIFY; ++j) {
+        double t = -1 + 2.0 * j / PLP_APPROX_VERIFY;
+        PLP_Model m = plp_observe_with(a->fn, a->lo + ((double)k + 0.5 * (t + 1)) * a->h);
+        double y, c;
+        approx_eval(a, k, t, &y, &c);
+        if (!(approx_err(y, c, m.output, m.coherence) <= a->max_err)) return 0;
+    }
+    return 1;
+}
+
+// Moves segment k to the exact path. Its constant terms become NaN so the
+// vector loop can spot it without a flag lookup.
+static void approx_flag(PLP_Approx *a, size_t k) {
+    if (a->exact[k]) return;
+    a->exact[k] = 1;
+    a->nexact++;
+    a->coef[8 * k] = a->coef[8 * k + 4] = NAN;
+}
+
+static void approx_batch_scalar(const PLP_Approx *a, const double *xs, size_t n, double *out, double *coh) {
+    const double lo = a->lo, inv_h = a->inv_h, top = (double)a->nseg;
+    const double *coef = a->coef;
+    const unsigned char *exact = a->exact;
+    for (size_t i = 0; i < n; ++i) {
+        double u = (xs[i] - lo) * inv_h;
+        if (u >= 0 && u <= top) {
+            int64_t k = (int64_t)u;
+            if (k == (int64_t)a->nseg) --k;   // x == hi
+            if (!exact[k]) {
+                double t = 2 * (u - (double)k) - 1;
+                out[i] = approx_horner(coef + 8 * k, t);
+                coh[i] = approx_horner(coef + 8 * k + 4, t);
+                continue;
+            }
+        }
+        PLP_Model m = plp_observe_with(a->fn, xs[i]);
+        out[i] = m.output;
+        coh[i] = m.coherence;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Four samples at a time with the coefficients gathered per lane; a group
+// with a lane outside [lo, hi] or on a flagged segment goes to the scalar loop.
+PLP_AVX2 static void approx_batch_avx2(const PLP_Approx *a, const double *xs, size_t n, double *out, double *coh) {
+    const __m256d lo = _mm256_set1_pd(a->lo), inv_h = _mm256_set1_pd(a->inv_h);
+    const __m256d top = _mm256_set1_pd((double)a->nseg), zero = _mm256_setzero_pd();
+    const __m256d two = _mm256_set1_pd(2.0), one = _mm256_set1_pd(1.0);
+    const __m128i last = _mm_set1_epi32((int)a->nseg - 1);
+    const double *coef = a->coef;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d u = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(xs + i), lo), inv_h);
+        __m256d in = _mm256_and_pd(_mm256_cmp_pd(u, zero, _CMP_GE_OQ), _mm256_cmp_pd(u, top, _CMP_LE_OQ));
+        if (_mm256_movemask_pd(in) != 0xF) {
+            approx_batch_scalar(a, xs + i, 4, out + i, coh + i);
+            continue;
+        }
+        __m128i k = _mm_min_epi32(_mm256_cvttpd_epi32(u), last);
+        __m256d t = _mm256_fmsub_pd(two, _mm256_sub_pd(u, _mm256_cvtepi32_pd(k)), one);
+        __m128i at = _mm_slli_epi32(k, 3);
+        __m256d y = _mm256_i32gather_pd(coef + 3, at, 8), c = _mm256_i32gather_pd(coef + 7, at, 8);
+        for (int j = 2; j >= 0; --j) {
+            y = _mm256_fmadd_pd(y, t, _mm256_i32gather_pd(coef + j, at, 8));
+            c = _mm256_fmadd_pd(c, t, _mm256_i32gather_pd(coef + 4 + j, at, 8));
+        }
+        if (_mm256_movemask_pd(_mm256_cmp_pd(y, c, _CMP_UNORD_Q))) {   // a flagged segment
+            approx_batch_scalar(a, xs + i, 4, out + i, coh + i);
+            continue;
+        }
+        _mm256_storeu_pd(out + i, y);
+        _mm256_storeu_pd(coh + i, c);
+    }
+    approx_batch_scalar(a, xs + i, n - i, out + i, coh + i);
+}
+#endif
+
+void plp_approx_observe_batch(const PLP_Approx *a, const double *xs, size_t n, double *out, double *coh) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (have_avx2()) { approx_batch_avx2(a, xs, n, out, coh); return; }
+#endif
+    approx_batch_scalar(a, xs, n, out, coh);
+}
+
+// Largest error of the tier against the exact path over samples
+// pseudo-random points; with mark set, segments exceeding max_err are moved
+// to the exact path and the error is taken afterwards.
+static double approx_check(PLP_Approx *a, size_t samples, int mark) {
+    uint64_t seed = 0x9E3779B97F4A7C15u;
+    double worst = 0;
+    for (size_t i = 0; i < samples; ++i) {
+        seed = seed * 6364136223846793005u + 1442695040888963407u;
+        double x = a->lo + (a->hi - a->lo) * (double)(seed >> 11) * 0x1p-53;
+        double y, c;
+        plp_approx_observe_batch(a, &x, 1, &y, &c);
+        PLP_Model m = plp_observe_with(a->fn, x);
+        double e = approx_err(y, c, m.output, m.coherence);
+        if (mark && !(e <= a->max_err)) {
+            size_t k = (size_t)((x - a->lo) * a->inv_h);
+            if (k >= a->nseg) k = a->nseg - 1;
+            approx_flag(a, k);
+            continue;
+        }
+        if (e > worst) worst = e;
+    }
+    return worst;
+}
+
+double plp_approx_check(const PLP_Approx *a, size_t samples) {
+    return approx_check((PLP_Approx *)a, samples, 0);
+}
+
+// Builds the tier for fn over [lo, hi] with error at most max_err (see
+// above). Returns NULL on a malformed range or a non-positive bound.
+PLP_Approx* plp_approx_new(const PLP_Function *fn, double lo, double hi, double max_err) {
+    if (!(hi > lo) || !isfinite(lo) || !isfinite(hi) || !(max_err > 0)) return NULL;
+    PLP_Approx *a = calloc(1, sizeof(PLP_Approx));
+    if (!a) { perror("calloc"); exit(1); }
+    a->fn = fn;
+    a->lo = lo;
+    a->hi = hi;
+    a->max_err = max_err;
+    for (size_t nseg = PLP_APPROX_MIN_SEGMENTS;; nseg *= 2) {
+        free(a->coef);
+        free(a->exact);
+        a->coef = malloc(nseg * 8 * sizeof(double));
+        a->exact = calloc(nseg, 1);
+        if (!a->coef || !a->exact) { perror("malloc"); exit(1); }
+        a->nseg = nseg;
+        a->h = (hi - lo) / (double)nseg;
+        a->inv_h = (double)nseg / (hi - lo);
+        a->nexact = 0;
+        for (size_t k = 0; k < nseg; ++k) {
+            approx_fit(a, k);
+            if (!approx_segment_ok(a, k)) approx_flag(a, k);
+        }
+        if (a->nexact * 64 <= nseg || nseg >= PLP_APPROX_MAX_SEGMENTS) break;
+    }
+    a->checked_err = approx_check(a, PLP_APPROX_CHECK, 1);
+    return a;
+}
+
+void plp_approx_free(PLP_Approx *a) {
+    if (!a) return;
+    free(a->coef);
+    free(a->exact);
+    free(a);
+}
+
+// --------------------- Sweep engine ---------------------
+// plp_sweep() observes fn at lo, lo + step, ... up to hi. The domain is cut
+// into fixed chunks of PLP_SWEEP_CHUNK samples (three double arrays of that
+// size stay in L2) handed to a pool of threads through an atomic counter. Each
+// chunk reduces into its own slot, and the slots are folded in chunk order,
+// so the statistics are bit-identical for any thread count. Sample i is
+// always lo + i * step, never an accumulated sum. Chunks are processed a
+// window at a time to bound memory on very long sweeps.
+#define PLP_SWEEP_CHUNK  2048
+#define PLP_SWEEP_WINDOW 1024   // chunks per window
+#define PLP_SWEEP_MAX_THREADS 64
+
+typedef struct {
+    double lo, hi;   // first and last sample of the run
+} PLP_Interval;
+
+typedef struct {
+    size_t samples;
+    double min, max, mean;   // coherence
+    double min_x, max_x;     // first sample reaching min / max
+    PLP_Interval *low;       // maximal runs of samples below the threshold, in x order
+    size_t nlow;
+} PLP_SweepStats;
+
+typedef struct {
+    double min, max, sum;
+    size_t min_i, max_i;
+    size_t *runs;   // [first, last] sample index pairs
+    size_t nruns, cap;
+} SweepChunk;
+
+typedef struct {
+    const PLP_Function *fn;
+    const PLP_Approx *approx;   // screening tier instead of fn, or NULL
+    double lo, step, threshold;
+    size_t n;              // samples
+    SweepChunk *slot;      // one per chunk of the current window
+    size_t first, count;   // window: chunks [first, first + count)
+    size_t next;           // next chunk of the window to claim
+    pthread_mutex_t mu;
+    pthread_cond_t go, done;
+    uint64_t round;        // bumped for every window
+    int pending;           // workers still busy with this window
+    int stop;
+} SweepJob;
+
+static void sweep_run_push(SweepChunk *r, size_t i) {
+    if (r->nruns && r->runs[2 * r->nruns - 1] + 1 == i) { r->runs[2 * r->nruns - 1] = i; return; }
+    if (r->nruns == r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 8;
+        r->runs = realloc(r->runs, r->cap * 2 * sizeof(size_t));
+        if (!r->runs) { perror("realloc"); exit(1); }
+    }
+    r->runs[2 * r->nruns] = r->runs[2 * r->nruns + 1] = i;
+    r->nruns++;
+}
+
+static void sweep_chunk(const SweepJob *job, size_t c, SweepChunk *r) {
+    double xs[PLP_SWEEP_CHUNK], out[PLP_SWEEP_CHUNK], coh[PLP_SWEEP_CHUNK];
+    size_t i0 = c * PLP_SWEEP_CHUNK, n = 0;
+    do xs[n] = job->lo + (double)(i0 + n) * job->step;   // every chunk holds at least one sample
+    while (++n < PLP_SWEEP_CHUNK && i0 + n < job->n);
+    if (job->approx) plp_approx_observe_batch(job->approx, xs, n, out, coh);
+    else plp_observe_batch_with(job->fn, xs, n, out, coh);
+    r->min = INFINITY; r->max = -INFINITY; r->sum = 0;
+    r->min_i = r->max_i = i0;
+    r->nruns = 0;
+    for (size_t k = 0; k < n; ++k) {
+        double v = coh[k];
+        if (v < r->min) { r->min = v; r->min_i = i0 + k; }
+        if (v > r->max) { r->max = v; r->max_i = i0 + k; }
+        r->sum += v;
+        if (v < job->threshold) sweep_run_push(r, i0 + k);
+    }
+}
+
+static void sweep_drain(SweepJob *job) {
+    size_t k;
+    while ((k = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count)
+        sweep_chunk(job, job->first + k, &job->slot[k]);
+}
+
+static void *sweep_worker(void *arg) {
+    SweepJob *job = arg;
+    uint64_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&job->mu);
+        while (job->round == seen && !job->stop) pthread_cond_wait(&job->go, &job->mu);
+        if (job->stop) { pthread_mutex_unlock(&job->mu); return NULL; }
+        seen = job->round;
+        pthread_mutex_unlock(&job->mu);
+        sweep_drain(job);
+        pthread_mutex_lock(&job->mu);
+        if (--job->pending == 0) pthread_cond_signal(&job->done);
+        pthread_mutex_unlock(&job->mu);
+    }
+}
+
+static void sweep_interval_push(PLP_SweepStats *st, size_t *cap, double lo, double hi) {
+    if (st->nlow == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        st->low = realloc(st->low, *cap * sizeof(PLP_Interval));
+        if (!st->low) { perror("realloc"); exit(1); }
+    }
+    st->low[st->nlow++] = (PLP_Interval){ lo, hi };
+}
+
+static int sweep_run(const PLP_Function *fn, const PLP_Approx *approx, double lo, double hi, double step,
+                     double threshold, int nthreads, PLP_SweepStats *out) {
+    memset(out, 0, sizeof(*out));
+    if (!(step > 0) || !(hi >= lo) || !isfinite(lo) || !isfinite(hi)) return -1;
+    double span = floor((hi - lo) / step + 1e-9);
+    if (!(span < (double)SIZE_MAX / 2)) return -1;
+    SweepJob job = { .fn = fn, .approx = approx, .lo = lo, .step = step, .threshold = threshold,
+                     .n = (size_t)span + 1 };
+    size_t nchunks = (job.n + PLP_SWEEP_CHUNK - 1) / PLP_SWEEP_CHUNK;
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > PLP_SWEEP_MAX_THREADS) nthreads = PLP_SWEEP_MAX_THREADS;
+    if ((size_t)nthreads > nchunks) nthreads = (int)nchunks;
+    job.slot = calloc(PLP_SWEEP_WINDOW, sizeof(SweepChunk));
+    if (!job.slot) { perror("calloc"); exit(1); }
+
+    pthread_t tid[PLP_SWEEP_MAX_THREADS];
+    int workers = nthreads > 1 ? nthreads - 1 : 0;   // the caller drains too
+    pthread_mutex_init(&job.mu, NULL);
+    pthread_cond_init(&job.go, NULL);
+    pthread_cond_init(&job.done, NULL);
+    for (int t = 0; t < workers; ++t)
+        if (pthread_create(&tid[t], NULL, sweep_worker, &job) != 0) { perror("pthread_create"); exit(1); }
+
+    out->samples = job.n;
+    out->min = INFINITY;
+    out->max = -INFINITY;
+    double sum = 0;
+    size_t cap = 0, open_last = SIZE_MAX;   // last sample of the run still open, if any
+    size_t open_first = 0;
+    for (size_t first = 0; first < nchunks; first += PLP_SWEEP_WINDOW) {
+        pthread_mutex_lock(&job.mu);
+        job.first = first;
+        job.count = nchunks - first < PLP_SWEEP_WINDOW ? nchunks - first : PLP_SWEEP_WINDOW;
+        job.next = 0;
+        job.pending = workers;
+        job.round++;
+        pthread_cond_broadcast(&job.go);
+        pthread_mutex_unlock(&job.mu);
+        sweep_drain(&job);
+        pthread_mutex_lock(&job.mu);
+        while (job.pending) pthread_cond_wait(&job.done, &job.mu);
+        pthread_mutex_unlock(&job.mu);
+
+        for (size_t k = 0; k < job.count; ++k) {
+            const SweepChunk *r = &job.slot[k];
+            if (r->min < out->min) { out->min = r->min; out->min_x = lo + (double)r->min_i * step; }
+            if (r->max > out->max) { out->max = r->max; out->max_x = lo + (double)r->max_i * step; }
+            sum += r->sum;
+            for (size_t j = 0; j < r->nruns; ++j) {
+                size_t a = r->runs[2 * j], b = r->runs[2 * j + 1];
+                if (open_last != SIZE_MAX && open_last + 1 == a) { open_last = b; continue; }   // continues across chunks
+                if (open_last != SIZE_MAX)
+                    sweep_interval_push(out, &cap, lo + (double)open_first * step, lo + (double)open_last * step);
+                open_first = a; open_last = b;
+            }
+        }
+    }
+    if (open_last != SIZE_MAX)
+        sweep_interval_push(out, &cap, lo + (double)open_first * step, lo + (double)open_last * step);
+    out->mean = sum / (double)job.n;
+
+    pthread_mutex_lock(&job.mu);
+    job.stop = 1;
+    pthread_cond_broadcast(&job.go);
+    pthread_mutex_unlock(&job.mu);
+    for (int t = 0; t < workers; ++t) pthread_join(tid[t], NULL);
+    pthread_cond_destroy(&job.done);
+    pthread_cond_destroy(&job.go);
+    pthread_mutex_destroy(&job.mu);
+    for (size_t k = 0; k < PLP_SWEEP_WINDOW; ++k) free(job.slot[k].runs);
+    free(job.slot);
+    return 0;
+}
+
+// Sweeps fn over [lo, hi] in steps of step on nthreads threads (0 = one per
+// online CPU) and reduces the coherence of every sample. Samples below
+// threshold are reported as maximal runs. Returns -1 on an empty or
+// malformed range; release the result with plp_sweep_free().
+int plp_sweep(const PLP_Function *fn, double lo, double hi, double step, double threshold,
+              int nthreads, PLP_SweepStats *out) {
+    return sweep_run(fn, NULL, lo, hi, step, threshold, nthreads, out);
+}
+
+// plp_sweep() on the approximation tier, for screening. Runs are taken below
+// threshold + max_err, so they hold every sample whose exact coherence is
+// below threshold; re-sweep just those with plp_sweep() to refine them.
+int plp_approx_sweep(const PLP_Approx *a, double lo, double hi, double step, double threshold,
+                     int nthreads, PLP_SweepStats *out) {
+    return sweep_run(a->fn, a, lo, hi, step, threshold + a->max_err, nthreads, out);
+}
+
+void plp_sweep_free(PLP_SweepStats *s) {
+    free(s->low);
+    s->low = NULL;
+    s->nlow = 0;
+}
+
+// --------------------- Adaptive sweep ---------------------
+// plp_sweep_adaptive() starts from PLP_ADAPTIVE_START equal intervals and
+// keeps the open ones in a max-heap. An interval is split at its midpoint
+// while its coherence crosses the threshold (until it is min_step wide) or
+// while the midpoint deviates from the chord between its ends by more than
+// tol, i.e. while coherence bends faster than the samples can follow.
+// Crossings come first and wider intervals before narrower ones, so a
+// budget of max_evals (0 = none) cuts off the least useful work; a budget
+// too small for the starting grid gets a coarser one, down to a single
+// interval. Midpoints are observed in batches of up to PLP_ADAPTIVE_BATCH
+// intervals.
+#define PLP_ADAPTIVE_START 1024
+#define PLP_ADAPTIVE_BATCH 512
+
+typedef struct {
+    double x, c;
+} AdaptSample;
+
+typedef struct {
+    double prio;
+    size_t a, m, b;   // samples at the ends and the midpoint
+} AdaptInterval;
+
+typedef struct {
+    const PLP_Function *fn;
+    double min_step, tol, threshold;
+    AdaptSample *s;
+    size_t ns, cap;
+    AdaptInterval *heap;
+    size_t nheap, heap_cap;
+} AdaptJob;
+
+static size_t adapt_sample(AdaptJob *j, double x, double c) {
+    if (j->ns == j->cap) {
+        j->cap = j->cap ? j->cap * 2 : 4096;
+        j->s = realloc(j->s, j->cap * sizeof(AdaptSample));
+        if (!j->s) { perror("realloc"); exit(1); }
+    }
+    j->s[j->ns] = (AdaptSample){ x, c };
+    return j->ns++;
+}
+
+// Queues [a, b] with midpoint m unless it is settled.
+static void adapt_push(AdaptJob *j, size_t a, size_t m, size_t b) {
+    const AdaptSample *sa = &j->s[a], *sm = &j->s[m], *sb = &j->s[b];
+    double width = sb->x - sa->x;
+    if (width / 2 < j->min_step) return;
+    if (!isfinite(sa->c) || !isfinite(sm->c) || !isfinite(sb->c)) return;
+    int below = (sa->c < j->threshold) + (sm->c < j->threshold) + (sb->c < j->threshold);
+    double prio;
+    if (below == 1 || below == 2) {
+        prio = 2 + width;   // coherence is at most 1, so deviations never outrank a crossing
+    } else {
+        prio = fabs(sm->c - 0.5 * (sa->c + sb->c));
+        if (!(prio > j->tol)) return;
+    }
+    if (j->nheap == j->heap_cap) {
+        j->heap_cap = j->heap_cap ? j->heap_cap * 2 : 1024;
+        j->heap = realloc(j->heap, j->heap_cap * sizeof(AdaptInterval));
+        if (!j->heap) { perror("realloc"); exit(1); }
+    }
+    size_t i = j->nheap++;
+    while (i && j->heap[(i - 1) / 2].prio < prio) {
+        j->heap[i] = j->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    j->heap[i] = (AdaptInterval){ prio, a, m, b };
+}
+
+static AdaptInterval adapt_pop(AdaptJob *j) {
+    AdaptInterval top = j->heap[0], last = j->heap[--j->nheap];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= j->nheap) break;
+        if (c + 1 < j->nheap && j->heap[c + 1].prio > j->heap[c].prio) ++c;
+        if (j->heap[c].prio <= last.prio) break;
+        j->heap[i] = j->heap[c];
+        i = c;
+    }
+    if (j->nheap) j->heap[i] = last;
+    return top;
+}
+
+static int adapt_cmp(const void *p, const void *q) {
+    double a = ((const AdaptSample *)p)->x, b = ((const AdaptSample *)q)->x;
+    return (a > b) - (a < b);
+}
+
+// Adaptive counterpart of plp_sweep() on one thread: the same statistics,
+// over the samples it chose rather than a grid. samples is the number of
+// observations, mean is the trapezoidal mean over [lo, hi], and the runs
+// below threshold have their ends within min_step of the crossing, and
+// samples never exceeds a nonzero max_evals. Returns -1 on a malformed range
+// or tolerance, or a max_evals below 3; release with plp_sweep_free().
+int plp_sweep_adaptive(const PLP_Function *fn, double lo, double hi, double min_step, double tol,
+                       double threshold, size_t max_evals, PLP_SweepStats *out) {
+    memset(out, 0, sizeof(*out));
+    if (!(hi > lo) || !isfinite(lo) || !isfinite(hi) || !(min_step > 0) || !(tol > 0)) return -1;
+    if (max_evals && max_evals < 3) return -1;
+    AdaptJob j = { .fn = fn, .min_step = min_step, .tol = tol, .threshold = threshold };
+    double xs[2 * PLP_ADAPTIVE_BATCH], yo[2 * PLP_ADAPTIVE_BATCH], co[2 * PLP_ADAPTIVE_BATCH];
+    AdaptInterval open[PLP_ADAPTIVE_BATCH];
+
+    size_t start = PLP_ADAPTIVE_START;
+    if (max_evals && 2 * start + 1 > max_evals) start = (max_evals - 1) / 2;
+    const size_t nx = 2 * start + 1;
+    for (size_t i = 0; i < nx; i += 2 * PLP_ADAPTIVE_BATCH) {
+        size_t n = nx - i < 2 * PLP_ADAPTIVE_BATCH ? nx - i : 2 * PLP_ADAPTIVE_BATCH;
+        for (size_t k = 0; k < n; ++k)
+            xs[k] = i + k == nx - 1 ? hi : lo + (hi - lo) * (double)(i + k) / (nx - 1);
+        plp_observe_batch_with(fn, xs, n, yo, co);
+        for (size_t k = 0; k < n; ++k) adapt_sample(&j, xs[k], co[k]);
+    }
+    for (size_t i = 0; i + 2 < nx; i += 2) adapt_push(&j, i, i + 1, i + 2);
+
+    while (j.nheap && (!max_evals || j.ns + 2 <= max_evals)) {
+        size_t n = 0;
+        while (j.nheap && n < PLP_ADAPTIVE_BATCH && (!max_evals || j.ns + 2 * (n + 1) <= max_evals)) {
+            open[n] = adapt_pop(&j);
+            xs[2 * n] = 0.5 * (j.s[open[n].a].x + j.s[open[n].m].x);
+            xs[2 * n + 1] = 0.5 * (j.s[open[n].m].x + j.s[open[n].b].x);
+            ++n;
+        }
+        plp_observe_batch_with(fn, xs, 2 * n, yo, co);
+        for (size_t k = 0; k < n; ++k) {
+            size_t l = adapt_sample(&j, xs[2 * k], co[2 * k]);
+            size_t r = adapt_sample(&j, xs[2 * k + 1], co[2 * k + 1]);
+            adapt_push(&j, open[k].a, l, open[k].m);
+            adapt_push(&j, open[k].m, r, open[k].b);
+        }
+    }
+    free(j.heap);
+
+    qsort(j.s, j.ns, sizeof(AdaptSample), adapt_cmp);
+    out->samples = j.ns;
+    out->min = INFINITY;
+    out->max = -INFINITY;
+    double area = 0;
+    size_t cap = 0, first = SIZE_MAX;
+    for (size_t i = 0; i < j.ns; ++i) {
+        const AdaptSample *p = &j.s[i];
+        if (p->c < out->min) { out->min = p->c; out->min_x = p->x; }
+        if (p->c > out->max) { out->max = p->c; out->max_x = p->x; }
+        if (i) area += 0.5 * (p->c + j.s[i - 1].c) * (p->x - j.s[i - 1].x);
+        if (p->c < threshold) {
+            if (first == SIZE_MAX) first = i;
+        } else if (first != SIZE_MAX) {
+            sweep_interval_push(out, &cap, j.s[first].x, j.s[i - 1].x);
+            first = SIZE_MAX;
+        }
+    }
+    if (first != SIZE_MAX) sweep_interval_push(out, &cap, j.s[first].x, j.s[j.ns - 1].x);
+    out->mean = area / (hi - lo);
+    free(j.s);
+    return 0;
+}
+
+// --------------------- Coherence tracker ---------------------
+// A PLP_Tracker follows a stream of coherence values in O(1) time per sample
+// and fixed memory (one ring of window doubles):
+//   - an EWMA of coherence and of its variance (weight alpha per sample);
+//   - mean and variance over the last window samples, updated by adding the
+//     new sample and retiring the oldest; both are recomputed from the ring
+//     every time it wraps, so rounding cannot accumulate;
+//   - a two-sided CUSUM against the mean since the last alarm: it alarms
+//     once the cumulative shift, less drift per sample, exceeds alarm, and
+//     then restarts from the new level.
+// Non-finite values are counted and otherwise ignored.
+typedef struct {
+    size_t window;
+    double alpha, drift, alarm;
+    double *ring;
+    size_t head, fill;          // next slot to write / samples in the ring
+    double win_mean, win_m2;
+    double ewma, ewma_var;
+    double ref_mean;            // CUSUM reference: mean since the last alarm
+    size_t ref_n;
+    double pos, neg;            // CUSUM sums
+    size_t samples, skipped, alarms, last_alarm;
+    double last;
+} PLP_Tracker;
+
+typedef struct {
+    size_t samples, skipped;
+    double last;
+    double ewma, ewma_sd;
+    size_t window;              // samples in the window
+    double mean, sd;            // over the window
+    size_t alarms;
+    size_t last_alarm;          // sample index of the latest alarm, SIZE_MAX if none
+} PLP_TrackerState;
+
+// Returns NULL unless window > 0, 0 < alpha <= 1, drift >= 0 and alarm > 0.
+PLP_Tracker* plp_tracker_new(size_t window, double alpha, double drift, double alarm) {
+    if (!window || !(alpha > 0 && alpha <= 1) || !(drift >= 0) || !(alarm > 0)) return NULL;
+    PLP_Tracker *t = calloc(1, sizeof(PLP_Tracker));
+    if (!t) { perror("calloc"); exit(1); }
+    t->ring = malloc(window * sizeof(double));
+    if (!t->ring) { perror("malloc"); exit(1); }
+    t->window = window;
+    t->alpha = alpha;
+    t->drift = drift;
+    t->alarm = alarm;
+    t->last = NAN;
+    t->last_alarm = SIZE_MAX;
+    return t;
+}
+
+static void tracker_rewindow(PLP_Tracker *t) {
+    double sum = 0, m2 = 0;
+    for (size_t i = 0; i < t->window; ++i) sum += t->ring[i];
+    double mean = sum / (double)t->window;
+    for (size_t i = 0; i < t->window; ++i) m2 += (t->ring[i] - mean) * (t->ring[i] - mean);
+    t->win_mean = mean;
+    t->win_m2 = m2;
+}
+
+static PLP_INLINE void tracker_push(PLP_Tracker *t, double v) {
+    if (t->samples == 0) {
+        t->ewma = v;
+    } else {
+        double d = v - t->ewma;
+        t->ewma += t->alpha * d;
+        t->ewma_var = (1 - t->alpha) * (t->ewma_var + t->alpha * d * d);
+    }
+
+    if (t->fill < t->window) {   // filling: plain Welford
+        double d = v - t->win_mean;
+        t->win_mean += d / (double)++t->fill;
+        t->win_m2 += d * (v - t->win_mean);
+        t->ring[t->head] = v;
+    } else {
+        double old = t->ring[t->head], mean = t->win_mean;
+        t->ring[t->head] = v;
+        t->win_mean += (v - old) / (double)t->window;
+        t->win_m2 += (v - old) * (v - t->win_mean + old - mean);
+        if (t->win_m2 < 0) t->win_m2 = 0;
+    }
+    if (++t->head == t->window) {
+        t->head = 0;
+        tracker_rewindow(t);
+    }
+
+    t->ref_mean += (v - t->ref_mean) / (double)++t->ref_n;
+    t->pos = fmax(0, t->pos + v - t->ref_mean - t->drift);
+    t->neg = fmax(0, t->neg + t->ref_mean - v - t->drift);
+    if (t->pos > t->alarm || t->neg > t->alarm) {
+        t->alarms++;
+        t->last_alarm = t->samples;
+        t->pos = t->neg = 0;
+        t->ref_mean = 0;
+        t->ref_n = 0;
+    }
+    t->samples++;
+    t->last = v;
+}
+
+// Feeds n coherence values, in stream order.
+void plp_tracker_update(PLP_Tracker *t, const double *coherence, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (isfinite(coherence[i])) tracker_push(t, coherence[i]);
+        else t->skipped++;
+    }
+}
+
+// Observes fn at xs in batches and feeds the coherence of every sample.
+void plp_tracker_observe(PLP_Tracker *t, const PLP_Function *fn, const double *xs, size_t n) {
+    double out[PLP_SWEEP_CHUNK], coh[PLP_SWEEP_CHUNK];
+    for (size_t i = 0; i < n; i += PLP_SWEEP_CHUNK) {
+        size_t k = n - i < PLP_SWEEP_CHUNK ? n - i : PLP_SWEEP_CHUNK;
+        plp_observe_batch_with(fn, xs + i, k, out, coh);
+        plp_tracker_update(t, coh, k);
+    }
+}
+
+void plp_tracker_read(const PLP_Tracker *t, PLP_TrackerState *out) {
+    out->samples = t->samples;
+    out->skipped = t->skipped;
+    out->last = t->last;
+    out->ewma = t->samples ? t->ewma : NAN;
+    out->ewma_sd = sqrt(t->ewma_var);
+    out->window = t->fill;
+    out->mean = t->fill ? t->win_mean : NAN;
+    out->sd = t->fill > 1 ? sqrt(t->win_m2 / (double)(t->fill - 1)) : 0;
+    out->alarms = t->alarms;
+    out->last_alarm = t->last_alarm;
+}
+
+void plp_tracker_free(PLP_Tracker *t) {
+    if (!t) return;
+    free(t->ring);
+    free(t);
+}
+
+// --------------------- Result cache ---------------------
+// A PLP_Cache memoises one model's observations in a direct-mapped table of
+// 2^bits slots. With quantum > 0 inputs are snapped to the nearest multiple
+// of quantum, so the key is that multiple and the cached result is the
+// observation at the snapped input; with quantum == 0 the key is the exact
+// bit pattern of x. A colliding key replaces the slot's entry. Inputs too
+// large to quantize, and non-finite ones, bypass the table. A cache can be
+// saved and preloaded into another cache of the same model and quantum.
+// Not thread-safe: give each thread its own cache.
+#define PLP_CACHE_MAGIC "PLPCACH1"
+
+typedef struct {
+    uint64_t key;
+    double out, coh;
+    uint64_t used;   // 0 empty, 1 filled, CACHE_PENDING + j: miss j of a running batch
+} PLP_CacheSlot;
+
+#define CACHE_PENDING 2u
+
+typedef struct {
+    size_t slots, used;
+    uint64_t hits, misses, evictions, bypassed;
+} PLP_CacheStats;
+
+typedef struct {
+    const PLP_Function *fn;
+    double quantum;
+    unsigned bits;
+    PLP_CacheSlot *slot;
+    PLP_CacheStats stats;
+} PLP_Cache;
+
+typedef struct {
+    char magic[8];
+    char model[24];
+    uint32_t bits;
+    uint32_t pad;
+    uint64_t count;
+    double quantum;
+} PLP_CacheFileHeader;
+
+// Returns NULL unless 4 <= bits <= 30 and quantum is finite and >= 0.
+PLP_Cache* plp_cache_new(const PLP_Function *fn, unsigned bits, double quantum) {
+    if (bits < 4 || bits > 30 || !(quantum >= 0) || !isfinite(quantum)) return NULL;
+    PLP_Cache *c = calloc(1, sizeof(PLP_Cache));
+    if (!c) { perror("calloc"); exit(1); }
+    c->slot = calloc((size_t)1 << bits, sizeof(PLP_CacheSlot));
+    if (!c->slot) { perror("calloc"); exit(1); }
+    c->fn = fn;
+    c->quantum = quantum;
+    c->bits = bits;
+    c->stats.slots = (size_t)1 << bits;
+    return c;
+}
+
+// Key for x and the input actually observed; 0 if x bypasses the cache.
+static int cache_key(const PLP_Cache *c, double x, uint64_t *key, double *snapped) {
+    if (!isfinite(x)) return 0;
+    if (c->quantum == 0) {
+        memcpy(key, &x, sizeof(x));
+        *snapped = x;
+        return 1;
+    }
+    double q = nearbyint(x / c->quantum);
+    if (!(fabs(q) < 0x1p62)) return 0;
+    *key = (uint64_t)(int64_t)q;
+    *snapped = q * c->quantum;
+    return 1;
+}
+
+// Quantized keys index the table directly, so neighbouring grid points sit in
+// neighbouring slots and a sweep walks the table sequentially. Exact keys are
+// double bit patterns and are hashed first.
+static PLP_CacheSlot* cache_slot(const PLP_Cache *c, uint64_t key) {
+    if (c->quantum == 0) return &c->slot[(key * 0x9E3779B97F4A7C15u) >> (64 - c->bits)];
+    return &c->slot[key & (c->stats.slots - 1)];
+}
+
+static void cache_fill(PLP_Cache *c, PLP_CacheSlot *s, uint64_t key, double out, double coh) {
+    if (!s->used) { s->used = 1; c->stats.used++; }
+    else if (s->key != key) c->stats.evictions++;
+    s->key = key;
+    s->out = out;
+    s->coh = coh;
+}
+
+PLP_Model plp_cache_observe(PLP_Cache *c, double x) {
+    uint64_t key;
+    double sx;
+    if (!cache_key(c, x, &key, &sx)) { c->stats.bypassed++; return plp_observe_with(c->fn, x); }
+    PLP_CacheSlot *s = cache_slot(c, key);
+    if (s->used == 1 && s->key == key) {
+        c->stats.hits++;
+        return (PLP_Model){ sx, s->out, s->coh };
+    }
+    c->stats.misses++;
+    PLP_Model m = plp_observe_with(c->fn, sx);
+    cache_fill(c, s, key, m.output, m.coherence);
+    return m;
+}
+
+// Misses of one plp_cache_observe_batch() call, observed together. A miss
+// claims its slot straight away, so a key repeated before the flush is a hit
+// on the pending miss (dup_of) rather than a second observation, and the
+// counts match calling plp_cache_observe() once per input.
+typedef struct {
+    size_t n, ndup;
+    double x[PLP_SWEEP_CHUNK], out[PLP_SWEEP_CHUNK], coh[PLP_SWEEP_CHUNK];
+    size_t at[PLP_SWEEP_CHUNK];     // index in the caller's arrays
+    uint64_t key[PLP_SWEEP_CHUNK];
+    unsigned char store[PLP_SWEEP_CHUNK];   // 0 for bypassed inputs
+    size_t dup_at[PLP_SWEEP_CHUNK], dup_of[PLP_SWEEP_CHUNK];
+} CacheMisses;
+
+static void cache_claim(PLP_Cache *c, PLP_CacheSlot *s, uint64_t key, size_t j) {
+    if (!s->used) c->stats.used++;
+    else if (s->key != key) c->stats.evictions++;
+    s->key = key;
+    s->used = CACHE_PENDING + j;
+}
+
+static void cache_flush(PLP_Cache *c, CacheMisses *m, double *out, double *coh) {
+    plp_observe_batch_with(c->fn, m->x, m->n, m->out, m->coh);
+    for (size_t j = 0; j < m->n; ++j) {
+        out[m->at[j]] = m->out[j];
+        coh[m->at[j]] = m->coh[j];
+        if (!m->store[j]) continue;
+        PLP_CacheSlot *s = cache_slot(c, m->key[j]);
+        if (s->key != m->key[j]) continue;   // claimed again by a later miss
+        s->used = 1;
+        s->out = m->out[j];
+        s->coh = m->coh[j];
+    }
+    for (size_t d = 0; d < m->ndup; ++d) {
+        out[m->dup_at[d]] = m->out[m->dup_of[d]];
+        coh[m->dup_at[d]] = m->coh[m->dup_of[d]];
+    }
+    m->n = m->ndup = 0;
+}
+
+// Batch form: hits are copied out, misses are observed together in batches
+// and then stored.
+void plp_cache_observe_batch(PLP_Cache *c, const double *xs, size_t n, double *out, double *coh) {
+    CacheMisses m;
+    m.n = m.ndup = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = 0;
+        double sx = xs[i];
+        int store = cache_key(c, xs[i], &key, &sx);
+        if (!store) {
+            c->stats.bypassed++;
+        } else {
+            PLP_CacheSlot *s = cache_slot(c, key);
+            if (s->used && s->key == key) {
+                c->stats.hits++;
+                if (s->used == 1) {
+                    out[i] = s->out;
+                    coh[i] = s->coh;
+                    continue;
+                }
+                m.dup_at[m.ndup] = i;
+                m.dup_of[m.ndup] = (size_t)(s->used - CACHE_PENDING);
+                if (++m.ndup == PLP_SWEEP_CHUNK) cache_flush(c, &m, out, coh);
+                continue;
+            }
+            c->stats.misses++;
+            cache_claim(c, s, key, m.n);
+        }
+        m.x[m.n] = sx;
+        m.at[m.n] = i;
+        m.key[m.n] = key;
+        m.store[m.n] = (unsigned char)store;
+        if (++m.n == PLP_SWEEP_CHUNK) cache_flush(c, &m, out, coh);
+    }
+    if (m.n || m.ndup) cache_flush(c, &m, out, coh);
+}
+
+void plp_cache_stats(const PLP_Cache *c, PLP_CacheStats *out) {
+    *out = c->stats;
+}
+
+// Writes the occupied slots to path; returns -1 on an I/O error.
+int plp_cache_save(const PLP_Cache *c, const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return -1;
+    PLP_CacheFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PLP_CACHE_MAGIC, 8);
+    strncpy(h.model, c->fn->name, sizeof(h.model) - 1);
+    h.bits = c->bits;
+    h.count = c->stats.used;
+    h.quantum = c->quantum;
+    int ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    for (size_t i = 0; ok && i < c->stats.slots; ++i)
+        if (c->slot[i].used) ok = fwrite(&c->slot[i], sizeof(PLP_CacheSlot), 1, fp) == 1;
+    if (fclose(fp) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+// Loads entries saved by plp_cache_save() into c; the table sizes may
+// differ. Returns the number of entries read, or -1 if path cannot be read
+// or was saved for another model or quantum.
+long plp_cache_preload(PLP_Cache *c, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+    PLP_CacheFileHeader h;
+    if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, PLP_CACHE_MAGIC, 8) != 0 ||
+        strncmp(h.model, c->fn->name, sizeof(h.model)) != 0 || h.quantum != c->quantum) {
+        fclose(fp);
+        return -1;
+    }
+    long n = 0;
+    PLP_CacheSlot e;
+    while ((uint64_t)n < h.count && fread(&e, sizeof(e), 1, fp) == 1) {
+        cache_fill(c, cache_slot(c, e.key), e.key, e.out, e.coh);
+        ++n;
+    }
+    fclose(fp);
+    return n;
+}
+
+void plp_cache_free(PLP_Cache *c) {
+    if (!c) return;
+    free(c->slot);
+    free(c);
+}
+
+// --------------------- Example ---------------------
+// The pipeline example includes this file with PLP_NO_EXAMPLE defined to reuse
+// the models without the demo.
+#ifndef PLP_NO_EXAMPLE
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Sweeps fn in batch mode and checks it against its scalar reference; the
+// samples are streamed to sink when one is given.
+static void sweep(const PLP_Function *fn, PlpSink *sink) {
+    enum { N = 1 << 20 };
+    static double xs[N], out[N], coh[N], ref_out[N], ref_coh[N];
+    for (size_t i = 0; i < N; ++i) xs[i] = -100.0 + 200.0 * (double)i / N;
+    double t0 = seconds();
+    fn->batch_scalar(xs, N, ref_out, ref_coh);
+    double t1 = seconds();
+    plp_observe_batch_with(fn, xs, N, out, coh);
+    double t2 = seconds();
+    double err_out = 0, err_coh = 0;
+    for (size_t i = 0; i < N; ++i) {
+        double e = fabs(out[i] - ref_out[i]) / fmax(fabs(ref_out[i]), 1.0);
+        if (e > err_out) err_out = e;
+        e = fabs(coh[i] - ref_coh[i]);
+        if (e > err_coh) err_coh = e;
+    }
+    printf("batch sweep %-8s: %d points | scalar %.1f ns/pt | batch %.1f ns/pt | max err f %.1e coherence %.1e\n",
+           fn->name, N, (t1 - t0) * 1e9 / N, (t2 - t1) * 1e9 / N, err_out, err_coh);
+    if (sink) {
+        plp_sink_models(sink, xs, out, coh, N);
+        printf("  streamed to sink in %.1f ns/pt\n", (seconds() - t2) * 1e9 / N);
+    }
+}
+
+// Usage: plp_function_model [-o file [-m | -t]] [-c cache] [model]
+//   Sweeps every registered model by default. With -o the demo rows and all
+//   batch sweep samples are streamed to file as binary blocks (-m: through an
+//   mmap-backed writer, -t: as text lines; "-" is stdout with -t). -c preloads the
+//   result cache from cache if it exists and saves it there at exit.
+int main(int argc, char **argv) {
+    const char *path = NULL, *cache_path = NULL;
+    PlpSinkMode mode = PLP_SINK_BINARY;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:mtc:")) != -1) {
+        switch (opt) {
+        case 'o': path = optarg; break;
+        case 'c': cache_path = optarg; break;
+        case 'm': mode = PLP_SINK_MMAP; break;
+        case 't': mode = PLP_SINK_TEXT; break;
+        default:
+            fprintf(stderr, "usage: %s [-o file [-m | -t]] [-c cache] [model]\n", argv[0]);
+            return 2;
+        }
+    }
+    PlpSink *sink = NULL;
+    if (path && !(sink = plp_sink_open(path, mode))) { perror(path); return 1; }
+
     for (double x = -3.14; x <= 3.14; x += 1.0) {
         PLP_Model m = plp_observe(x);
-        printf("x = %+.2f | f(x) = %+.3f | coherence = %.3f\n", m.input, m.output, m.coherence);
+        if (sink) plp_sink_model(sink, m.input, m.output, m.coherence);
+        else printf("x = %+.2f | f(x) = %+.3f | coherence = %.3f\n", m.input, m.output, m.coherence);
+    }
+
+    const PLP_Function *fn = &plp_functions[0];
+    if (optind < argc) {
+        fn = plp_function_find(argv[optind]);
+        if (!fn) {
+            fprintf(stderr, "unknown model '%s'; registered:\n", argv[optind]);
+            for (size_t i = 0; i < PLP_NFUNCTIONS; ++i)
+                fprintf(stderr, "  %-8s %s\n", plp_functions[i].name, plp_functions[i].desc);
+            return 1;
+        }
+        sweep(fn, sink);
+    } else {
+        for (size_t i = 0; i < PLP_NFUNCTIONS; ++i) sweep(&plp_functions[i], sink);
+    }
+    if (sink && plp_sink_close(sink) != 0) { perror(path); return 1; }
+
+    // sweep engine: same statistics on one thread and on all of them
+    PLP_SweepStats one, all;
+    double t0 = seconds();
+    plp_sweep(fn, -100.0, 100.0, 1e-5, 0.4, 1, &one);
+    double t1 = seconds();
+    plp_sweep(fn, -100.0, 100.0, 1e-5, 0.4, 0, &all);
+    double t2 = seconds();
+    int same = one.nlow == all.nlow && memcmp(&one, &all, offsetof(PLP_SweepStats, low)) == 0 &&
+               memcmp(one.low, all.low, one.nlow * sizeof(PLP_Interval)) == 0;
+    printf("plp_sweep %s [-100, 100] step 1e-5: %zu samples | coherence min %.4f at %+.5f, max %.4f at %+.5f, mean %.4f\n",
+           fn->name, all.samples, all.min, all.min_x, all.max, all.max_x, all.mean);
+    printf("  %zu runs below 0.4, first [%+.5f, %+.5f] | 1 thread %.2fs, %ld threads %.2fs | deterministic: %s\n",
+           all.nlow, all.nlow ? all.low[0].lo : 0.0, all.nlow ? all.low[0].hi : 0.0,
+           t1 - t0, sysconf(_SC_NPROCESSORS_ONLN), t2 - t1, same ? "yes" : "NO");
+
+    // approximation tier: screen the same sweep, then refine only the flagged runs exactly
+    double t5 = seconds();
+    PLP_Approx *ap = plp_approx_new(fn, -100.0, 100.0, 1e-4);
+    double t6 = seconds();
+    PLP_SweepStats screen;
+    plp_approx_sweep(ap, -100.0, 100.0, 1e-5, 0.4, 0, &screen);
+    double t7 = seconds();
+    size_t refined = 0, refined_samples = 0;
+    for (size_t r = 0; r < screen.nlow; ++r) {
+        PLP_SweepStats sub;
+        plp_sweep(fn, screen.low[r].lo, screen.low[r].hi, 1e-5, 0.4, 1, &sub);
+        refined += sub.nlow;
+        refined_samples += sub.samples;
+        plp_sweep_free(&sub);
+    }
+    double t8 = seconds();
+    printf("approx %s: %zu segments (%zu exact), max err %.0e, checked %.1e | build %.2fs\n",
+           fn->name, ap->nseg, ap->nexact, ap->max_err, ap->checked_err, t6 - t5);
+    printf("  screen %.2fs (exact sweep %.2fs) | refine %zu flagged runs, %.1f%% of samples, in %.2fs: "
+           "%zu runs below 0.4 (exact sweep: %zu)\n", t7 - t6, t2 - t1, screen.nlow,
+           100.0 * (double)refined_samples / (double)all.samples, t8 - t7, refined, all.nlow);
+    plp_sweep_free(&screen);
+    plp_approx_free(ap);
+
+    // adaptive sweep: the same runs from a few thousand observations
+    PLP_SweepStats ad;
+    double t9 = seconds();
+    plp_sweep_adaptive(fn, -100.0, 100.0, 1e-5, 1e-5, 0.4, 0, &ad);
+    double t10 = seconds();
+    double edge = 0;
+    for (size_t r = 0; r < ad.nlow && ad.nlow == all.nlow; ++r)
+        edge = fmax(edge, fmax(fabs(ad.low[r].lo - all.low[r].lo), fabs(ad.low[r].hi - all.low[r].hi)));
+    printf("adaptive %s: %zu observations (grid: %zu) | %zu runs below 0.4 (grid: %zu)", fn->name,
+           ad.samples, all.samples, ad.nlow, all.nlow);
+    if (ad.nlow == all.nlow) printf(", ends within %.1e", edge);
+    printf(" | mean %.4f | %.1f ms\n", ad.mean, (t10 - t9) * 1e3);
+    plp_sweep_free(&ad);
+    plp_sweep_free(&one);
+    plp_sweep_free(&all);
+
+    // coherence tracker: a stream whose inputs move from [-3, 3] to [20, 26]
+    // half way through, fed in batches
+    enum { STREAM = 1 << 22, BATCH = 1 << 16 };
+    static double xs[BATCH];
+    PLP_Tracker *tr = plp_tracker_new(4096, 1.0 / 1024, 0.02, 20.0);
+    uint64_t seed = 42;
+    double tracked = 0;
+    for (size_t b = 0; b < STREAM / BATCH; ++b) {
+        double base = b < STREAM / BATCH / 2 ? -3.0 : 20.0;
+        for (size_t i = 0; i < BATCH; ++i) {
+            seed = seed * 6364136223846793005u + 1442695040888963407u;
+            xs[i] = base + 6.0 * (double)(seed >> 11) * 0x1p-53;
+        }
+        double t3 = seconds();
+        plp_tracker_observe(tr, fn, xs, BATCH);
+        tracked += seconds() - t3;
+    }
+    PLP_TrackerState st;
+    plp_tracker_read(tr, &st);
+    printf("tracker %s: %zu samples in batches of %d | %.1f ns/sample | ewma %.4f sd %.4f | window %zu mean %.4f sd %.4f\n",
+           fn->name, st.samples, BATCH, tracked * 1e9 / (double)st.samples, st.ewma, st.ewma_sd, st.window, st.mean, st.sd);
+    if (st.alarms)
+        printf("  %zu drift alarms, latest at sample %zu (inputs shift at %d)\n", st.alarms, st.last_alarm, STREAM / 2);
+    else
+        printf("  no drift alarms (inputs shift at %d)\n", STREAM / 2);
+    plp_tracker_free(tr);
+
+    // result cache: two overlapping sweeps on a 1e-3 grid
+    enum { GRID = 400001 };
+    static double gx[GRID], gout[GRID], gcoh[GRID];
+    PLP_Cache *cache = plp_cache_new(fn, 20, 1e-3);
+    long preloaded = cache_path ? plp_cache_preload(cache, cache_path) : -1;
+    if (preloaded >= 0) printf("cache: preloaded %ld entries from %s\n", preloaded, cache_path);
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < GRID; ++i) gx[i] = (pass ? -100.0 : -200.0) + (double)i * 1e-3;
+        PLP_CacheStats before, after;
+        plp_cache_stats(cache, &before);
+        double t3 = seconds();
+        plp_cache_observe_batch(cache, gx, GRID, gout, gcoh);
+        double t4 = seconds();
+        plp_cache_stats(cache, &after);
+        printf("cache %s: sweep [%+.0f, %+.0f] step 1e-3 | %.1f%% hits | %.1f ns/pt | %zu of %zu slots used\n",
+               fn->name, gx[0], gx[GRID - 1], 100.0 * (double)(after.hits - before.hits) / GRID,
+               (t4 - t3) * 1e9 / GRID, after.used, after.slots);
     }
+    if (cache_path && plp_cache_save(cache, cache_path) != 0) perror(cache_path);
+    plp_cache_free(cache);
     return 0;
 }
+#endif
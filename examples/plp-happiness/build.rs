@@ -0,0 +1,32 @@
+// Compiles the C patrie (without its demo) into a static library for the
+// record ABI in src/record.rs.
+use std::env;
+use std::path::PathBuf;
+use std::process::Command;
+
+fn main() {
+    let out = PathBuf::from(env::var("OUT_DIR").expect("OUT_DIR"));
+    let cc = env::var("CC").unwrap_or_else(|_| "cc".to_string());
+    let obj = out.join("patrie.o");
+    println!("cargo:rerun-if-changed=pheno_happiness/main.c");
+    println!("cargo:rerun-if-changed=../common/plp_sink.h");
+
+    let ok = Command::new(&cc)
+        .args(["-O2", "-fPIC", "-DPATRIE_NO_EXAMPLE", "-c", "pheno_happiness/main.c", "-o"])
+        .arg(&obj)
+        .status()
+        .map_or(false, |s| s.success());
+    assert!(ok, "failed to compile pheno_happiness/main.c with {cc}");
+    let ok = Command::new("ar")
+        .arg("crs")
+        .arg(out.join("libpatrie.a"))
+        .arg(&obj)
+        .status()
+        .map_or(false, |s| s.success());
+    assert!(ok, "failed to archive libpatrie.a");
+
+    println!("cargo:rustc-link-search=native={}", out.display());
+    println!("cargo:rustc-link-lib=static=patrie");
+    println!("cargo:rustc-link-lib=pthread");
+    println!("cargo:rustc-link-lib=m");
+}
@@ -0,0 +1,298 @@
+// Benchmark driver for the trie in main.c. Runs insert, lookup-hit,
+// lookup-miss, enumerate and mixed workloads over one key distribution and
+// prints one JSON object per workload, so results can be diffed across
+// releases:
+//
+//   ./patrie_bench -n 1000000 -d zipf -w hit,mixed
+//
+// Every BENCH_SAMPLE-th operation is timed on its own for the latency
+// percentiles (timer overhead subtracted); throughput is taken over the whole
+// run. peak_rss_kb is the process high-water mark, so it only grows from one
+// workload to the next.
+#define PATRIE_NO_EXAMPLE
+#include "main.c"
+
+#include <time.h>
+#include <sys/resource.h>
+
+#define BENCH_SAMPLE 16
+
+typedef enum { DIST_UNIFORM, DIST_ZIPF, DIST_PREFIX } BenchDist;
+
+static const char *const dist_name[] = { "uniform", "zipf", "prefix" };
+
+typedef struct {
+    size_t nkeys, nops;
+    BenchDist dist;
+    double skew;        // Zipf exponent
+    unsigned read_pct;  // share of lookups in the mixed workload
+    uint64_t seed;
+    int hash_index;
+} BenchConfig;
+
+typedef struct {
+    BenchConfig cfg;
+    char **keys;        // distinct, in insertion order
+    char **miss;        // keys[i] with its last byte swapped for one no key uses
+    uint32_t *pick;     // key index of each lookup/mixed operation
+    uint8_t *is_read;   // mixed workload: lookup (1) or insert (0)
+    TrieNode *root;
+    PatrieCursor *cur;
+    size_t hits;        // keeps lookups observable
+    uint64_t *lat;
+    size_t nlat, lat_cap;
+} Bench;
+
+// --------------------- Helpers ---------------------
+static uint64_t rng_next(uint64_t *s) {   // splitmix64
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static double rng_unit(uint64_t *s) { return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0); }
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *x, const void *y) {
+    uint64_t a = *(const uint64_t *)x, b = *(const uint64_t *)y;
+    return (a > b) - (a < b);
+}
+
+static int cmp_str(const void *x, const void *y) { return strcmp(*(char *const *)x, *(char *const *)y); }
+
+static char *key_gen(BenchDist dist, uint64_t *s) {
+    char buf[64];
+    size_t len = 0;
+    if (dist == DIST_PREFIX) {
+        // few top-level groups, long shared labels, a short random tail
+        len = (size_t)snprintf(buf, sizeof(buf), "phenotype/r%02u/c%03u/",
+                               (unsigned)(rng_next(s) % 16), (unsigned)(rng_next(s) % 64));
+        for (int i = 0; i < 8; ++i) buf[len++] = (char)('a' + rng_next(s) % 26);
+    } else {
+        size_t n = 6 + rng_next(s) % 11;
+        for (size_t i = 0; i < n; ++i) buf[len++] = (char)('a' + rng_next(s) % 26);
+    }
+    buf[len] = '\0';
+    char *k = strdup(buf);
+    if (!k) { perror("malloc"); exit(1); }
+    return k;
+}
+
+// Draws keys until nkeys distinct ones exist, then shuffles them so inserts
+// do not arrive in sorted order.
+static void keys_make(Bench *b, uint64_t *s) {
+    size_t n = b->cfg.nkeys, have = 0;
+    b->keys = malloc(n * sizeof(char *));
+    b->miss = malloc(n * sizeof(char *));
+    if (!b->keys || !b->miss) { perror("malloc"); exit(1); }
+    while (have < n) {
+        while (have < n) b->keys[have++] = key_gen(b->cfg.dist, s);
+        qsort(b->keys, n, sizeof(char *), cmp_str);
+        size_t w = 1;
+        for (size_t i = 1; i < n; ++i) {
+            if (strcmp(b->keys[i], b->keys[w - 1]) == 0) free(b->keys[i]);
+            else b->keys[w++] = b->keys[i];
+        }
+        have = w;
+    }
+    for (size_t i = n; i > 1; --i) {
+        size_t j = rng_next(s) % i;
+        char *k = b->keys[i - 1]; b->keys[i - 1] = b->keys[j]; b->keys[j] = k;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        b->miss[i] = strdup(b->keys[i]);
+        if (!b->miss[i]) { perror("malloc"); exit(1); }
+        b->miss[i][strlen(b->miss[i]) - 1] = '~';
+    }
+}
+
+// Zipf ranks are mapped onto the shuffled key order, so hot keys are spread
+// over the whole trie rather than clustered in one subtrie.
+static void picks_make(Bench *b, uint64_t *s) {
+    size_t n = b->cfg.nkeys, m = b->cfg.nops;
+    b->pick = malloc(m * sizeof(uint32_t));
+    b->is_read = malloc(m);
+    if (!b->pick || !b->is_read) { perror("malloc"); exit(1); }
+    if (b->cfg.dist == DIST_ZIPF) {
+        double *cdf = malloc(n * sizeof(double)), sum = 0;
+        if (!cdf) { perror("malloc"); exit(1); }
+        for (size_t i = 0; i < n; ++i) cdf[i] = (sum += 1.0 / pow((double)(i + 1), b->cfg.skew));
+        for (size_t i = 0; i < m; ++i) {
+            double u = rng_unit(s) * sum;
+            size_t lo = 0, hi = n - 1;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+            }
+            b->pick[i] = (uint32_t)lo;
+        }
+        free(cdf);
+    } else {
+        for (size_t i = 0; i < m; ++i) b->pick[i] = (uint32_t)(rng_next(s) % n);
+    }
+    for (size_t i = 0; i < m; ++i) b->is_read[i] = rng_next(s) % 100 < b->cfg.read_pct;
+}
+
+// Bytes the trie has claimed: the used part of each arena chunk (blocks on
+// the free lists included) plus the side tables kept in malloc.
+static size_t trie_footprint(TrieNode *root) {
+    Patrie *t = patrie_of(root);
+    size_t bytes = sizeof(Patrie);
+    for (ArenaChunk *c = t->arena.head; c; c = c->next) bytes += ARENA_CHUNK_HDR + c->used;
+    bytes += t->meta.cap * sizeof(const char *);
+    bytes += t->pheno.free_cap * sizeof(PhenoId);
+    if (t->hidx) bytes += t->hidx->cap * (1 + sizeof(HashSlot));
+    return bytes;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : -1;
+}
+
+// --------------------- Workloads ---------------------
+typedef void (*bench_op)(Bench *b, size_t i);
+
+static void op_insert(Bench *b, size_t i) {
+    patrie_insert(b->root, b->keys[i], (double)(i % 1000) / 1000.0, (QualFlags)(i & 0xF), NULL);
+}
+
+static void op_hit(Bench *b, size_t i) {
+    b->hits += (size_t)patrie_lookup(b->root, b->keys[b->pick[i]], NULL);
+}
+
+static void op_miss(Bench *b, size_t i) {
+    b->hits += (size_t)patrie_lookup(b->root, b->miss[b->pick[i]], NULL);
+}
+
+static void op_enumerate(Bench *b, size_t i) {
+    const char *token;
+    Phenotype p;
+    (void)i;
+    b->hits += (size_t)patrie_cursor_next(b->cur, &token, &p);
+}
+
+static void op_mixed(Bench *b, size_t i) {
+    const char *key = b->keys[b->pick[i]];
+    if (b->is_read[i]) b->hits += (size_t)patrie_lookup(b->root, key, NULL);
+    else patrie_insert(b->root, key, (double)(i % 1000) / 1000.0, (QualFlags)(i & 0xF), NULL);
+}
+
+// Median cost of an empty timed region, taken off every sample.
+static uint64_t timer_overhead(void) {
+    uint64_t v[1001];
+    for (size_t i = 0; i < 1001; ++i) { uint64_t t0 = now_ns(); v[i] = now_ns() - t0; }
+    qsort(v, 1001, sizeof(uint64_t), cmp_u64);
+    return v[500];
+}
+
+static void bench_run(Bench *b, const char *name, size_t nops, bench_op op, uint64_t overhead) {
+    size_t need = nops / BENCH_SAMPLE + 1;
+    if (need > b->lat_cap) {
+        b->lat = realloc(b->lat, need * sizeof(uint64_t));
+        if (!b->lat) { perror("realloc"); exit(1); }
+        b->lat_cap = need;
+    }
+    b->nlat = 0;
+    b->hits = 0;
+    patrie_stats_reset(b->root);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < nops; ++i) {
+        if (i % BENCH_SAMPLE) { op(b, i); continue; }
+        uint64_t t0 = now_ns();
+        op(b, i);
+        uint64_t d = now_ns() - t0;
+        b->lat[b->nlat++] = d > overhead ? d - overhead : 0;
+    }
+    double secs = (double)(now_ns() - start) / 1e9;
+    qsort(b->lat, b->nlat, sizeof(uint64_t), cmp_u64);
+    uint64_t p50 = b->nlat ? b->lat[b->nlat / 2] : 0;
+    uint64_t p99 = b->nlat ? b->lat[b->nlat * 99 / 100] : 0;
+    size_t live = patrie_pheno_count(b->root);
+    printf("{\"workload\":\"%s\",\"dist\":\"%s\",\"keys\":%zu,\"ops\":%zu,\"hash_index\":%d,"
+           "\"hits\":%zu,\"secs\":%.6f,\"ops_per_sec\":%.0f,\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 ","
+           "\"bytes_per_key\":%.1f,\"peak_rss_kb\":%ld",
+           name, dist_name[b->cfg.dist], b->cfg.nkeys, nops, b->cfg.hash_index, b->hits, secs,
+           secs > 0 ? (double)nops / secs : 0.0, p50, p99,
+           live ? (double)trie_footprint(b->root) / (double)live : 0.0, peak_rss_kb());
+    PatrieStats st;
+    if (patrie_stats(b->root, &st))   // built with -DPATRIE_STATS
+        printf(",\"nodes_per_lookup\":%.2f,\"node_grows\":%" PRIu64 ",\"edge_splits\":%" PRIu64 ","
+               "\"allocs\":%" PRIu64 ",\"alloc_bytes\":%" PRIu64,
+               st.lookups ? (double)st.lookup_nodes / (double)st.lookups : 0.0,
+               st.node_grows, st.edge_splits, st.allocs, st.alloc_bytes);
+    printf("}\n");
+    fflush(stdout);
+}
+
+// --------------------- Driver ---------------------
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-n keys] [-o ops] [-d uniform|zipf|prefix] [-z skew] [-r read%%]\n"
+            "          [-w insert,hit,miss,enumerate,mixed] [-s seed] [-x]\n"
+            "  -o  operations per lookup/mixed workload (default: keys)\n"
+            "  -x  enable the hash index before the run\n", argv0);
+}
+
+static int wants(const char *list, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = list; (p = strstr(p, name)); p += len)
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0')) return 1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    BenchConfig cfg = { .nkeys = 1000000, .dist = DIST_UNIFORM, .skew = 0.99, .read_pct = 90, .seed = 42 };
+    const char *work = "insert,hit,miss,enumerate,mixed";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:d:z:r:w:s:x")) != -1) {
+        switch (opt) {
+        case 'n': cfg.nkeys = strtoull(optarg, NULL, 10); break;
+        case 'o': cfg.nops = strtoull(optarg, NULL, 10); break;
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0) cfg.dist = DIST_UNIFORM;
+            else if (strcmp(optarg, "zipf") == 0) cfg.dist = DIST_ZIPF;
+            else if (strcmp(optarg, "prefix") == 0) cfg.dist = DIST_PREFIX;
+            else { usage(argv[0]); return 2; }
+            break;
+        case 'z': cfg.skew = strtod(optarg, NULL); break;
+        case 'r': cfg.read_pct = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'w': work = optarg; break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 10); break;
+        case 'x': cfg.hash_index = 1; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (cfg.nkeys == 0 || cfg.nkeys > UINT32_MAX || cfg.read_pct > 100) { usage(argv[0]); return 2; }
+    if (cfg.nops == 0) cfg.nops = cfg.nkeys;
+
+    Bench b = { .cfg = cfg };
+    uint64_t s = cfg.seed;
+    keys_make(&b, &s);
+    picks_make(&b, &s);
+    uint64_t overhead = timer_overhead();
+
+    b.root = patrie_new();
+    if (cfg.hash_index) patrie_hash_index_enable(b.root);
+    if (wants(work, "insert")) bench_run(&b, "insert", cfg.nkeys, op_insert, overhead);
+    else for (size_t i = 0; i < cfg.nkeys; ++i) op_insert(&b, i);
+    if (wants(work, "hit")) bench_run(&b, "hit", cfg.nops, op_hit, overhead);
+    if (wants(work, "miss")) bench_run(&b, "miss", cfg.nops, op_miss, overhead);
+    if (wants(work, "enumerate")) {
+        b.cur = patrie_cursor_open(b.root, NULL, 1);
+        bench_run(&b, "enumerate", cfg.nkeys, op_enumerate, overhead);
+        patrie_cursor_close(b.cur);
+    }
+    if (wants(work, "mixed")) bench_run(&b, "mixed", cfg.nops, op_mixed, overhead);
+
+    trie_free(b.root);
+    for (size_t i = 0; i < cfg.nkeys; ++i) { free(b.keys[i]); free(b.miss[i]); }
+    free(b.keys); free(b.miss); free(b.pick); free(b.is_read); free(b.lat);
+    return 0;
+}
@@ -0,0 +1 @@
+gcc -O2 -Wa,--noexecstack -Wl,-z,noexecstack bench.c -o patrie_bench -pthread -lm "$@"
@@ -1 +1 @@
-gcc -Wa,--noexecstack -Wl,-z,noexecstack main.c -o phenotype
+gcc -Wa,--noexecstack -Wl,-z,noexecstack main.c -o phenotype -pthread
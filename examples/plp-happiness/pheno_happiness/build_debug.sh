@@ -1 +1 @@
-gcc -g -Wall -Wextra -o phenotype main.c
+gcc -g -Wall -Wextra -o phenotype main.c -pthread
@@ -1,8 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include "../../common/plp_sink.h"
 
 // --------------------- Domain Types ---------------------
 typedef enum {
@@ -13,254 +30,3458 @@ typedef enum {
     QUAL_OPTIMIST  = 1<<3,
 } QualFlags;
 
+// Phenotypes are stored column-wise inside the trie and addressed by a dense
+// id assigned at creation (ids of deleted rows are reused); a Phenotype is a
+// materialised copy of one row.
+typedef uint32_t PhenoId;
+#define PHENO_NONE UINT32_MAX
+
 typedef struct {
     double score;
     uint64_t visits;
     QualFlags qual;
-    char *meta;
+    PhenoId id;
+    const char *meta;   // interned; valid until the row is deleted or its meta replaced (always, in concurrent mode)
 } Phenotype;
 
-// --------------------- AVL (children map) ---------------------
-struct TrieNode; // forward
+// --------------------- Stats ---------------------
+// Building with -DPATRIE_STATS turns on hot-path counters, read back with
+// patrie_stats(). Without it STAT_ADD expands to nothing and patrie_stats()
+// reports zeros. Counters are relaxed atomics, so concurrent readers and
+// parallel ingest may bump them; a snapshot counts its own lookups.
+typedef struct {
+    uint64_t lookups;        // point lookups, hashed and batched ones included
+    uint64_t lookup_misses;
+    uint64_t lookup_nodes;   // nodes entered by trie-walking lookups, root included
+    uint64_t node_grows;     // child maps promoted to the next wider kind
+    uint64_t node_shrinks;   // child maps rebuilt narrower after a delete
+    uint64_t edge_splits;    // labels split by an insert
+    uint64_t path_copies;    // nodes copied because a snapshot still saw them
+    uint64_t allocs;         // arena blocks handed out, free-list reuse included
+    uint64_t alloc_bytes;
+    uint64_t chunks;         // chunks taken from the PatrieAllocator
+    uint64_t chunk_bytes;
+    uint64_t enum_tokens;    // tokens yielded by cursors (enumeration, scans)
+    uint64_t enum_ns;        // time cursors were open
+} PatrieStats;
+
+#ifdef PATRIE_STATS
+#define STAT_ADD(counter, n) __atomic_fetch_add(&(counter), (uint64_t)(n), __ATOMIC_RELAXED)
+
+static uint64_t stat_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#else
+#define STAT_ADD(counter, n) ((void)0)
+#endif
+
+// --------------------- Arena ---------------------
+// All trie memory (nodes, child maps, phenotype columns, meta strings) is carved out of
+// chunks owned by the root. The chunk source is pluggable; chunks must be
+// ARENA_ALIGN-aligned, which malloc already guarantees.
+typedef struct {
+    void *(*chunk_alloc)(size_t size, void *ctx);
+    void (*chunk_free)(void *chunk, size_t size, void *ctx);
+    void *ctx;
+} PatrieAllocator;
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;   // usable bytes after the header
+    size_t used;
+} ArenaChunk;
+
+#define ARENA_ALIGN       16
+#define ARENA_CHUNK_MIN   (64 * 1024)
+#define ARENA_CHUNK_MAX   (4 * 1024 * 1024)
+#define ARENA_ROUND(n)    (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_CHUNK_HDR   ARENA_ROUND(sizeof(ArenaChunk))
+#define ARENA_SLAB_MAX    4096   // blocks up to this size are recycled by size class
+
+typedef struct {
+    PatrieAllocator alloc;
+    ArenaChunk *head;
+    size_t next_chunk;
+    void *slab[ARENA_SLAB_MAX / ARENA_ALIGN + 1];   // free lists, one per size class
+#ifdef PATRIE_STATS
+    uint64_t allocs, alloc_bytes, chunks, chunk_bytes;
+#endif
+} Arena;
+
+static void *default_chunk_alloc(size_t size, void *ctx) { (void)ctx; return malloc(size); }
+static void default_chunk_free(void *chunk, size_t size, void *ctx) { (void)size; (void)ctx; free(chunk); }
+
+static ArenaChunk* arena_chunk_new(Arena *a, size_t size) {
+    ArenaChunk *c = a->alloc.chunk_alloc(ARENA_CHUNK_HDR + size, a->alloc.ctx);
+    if (!c) { perror("arena"); exit(1); }
+    STAT_ADD(a->chunks, 1);
+    STAT_ADD(a->chunk_bytes, ARENA_CHUNK_HDR + size);
+    c->size = size; c->used = 0;
+    return c;
+}
+
+static void *arena_bump(Arena *a, size_t size, size_t align) {
+    ArenaChunk *c = a->head;
+    size_t off = c ? (c->used + align - 1) & ~(align - 1) : 0;
+    if (!c || c->size < off + size) {
+        if (size > a->next_chunk / 4) {
+            // oversized request: give it a private chunk behind the current one
+            // so the head keeps serving small allocations
+            ArenaChunk *big = arena_chunk_new(a, size);
+            if (c) { big->next = c->next; c->next = big; }
+            else { big->next = NULL; a->head = big; }
+            big->used = size;
+            return (char *)big + ARENA_CHUNK_HDR;
+        }
+        c = arena_chunk_new(a, a->next_chunk);
+        c->next = a->head; a->head = c;
+        if (a->next_chunk < ARENA_CHUNK_MAX) a->next_chunk *= 2;
+        off = 0;
+    }
+    c->used = off + size;
+    return (char *)c + ARENA_CHUNK_HDR + off;
+}
+
+static void *arena_alloc(Arena *a, size_t size) {
+    size = ARENA_ROUND(size);
+    STAT_ADD(a->allocs, 1);
+    STAT_ADD(a->alloc_bytes, size);
+    if (size <= ARENA_SLAB_MAX && a->slab[size / ARENA_ALIGN]) {
+        void **blk = a->slab[size / ARENA_ALIGN];
+        a->slab[size / ARENA_ALIGN] = *blk;
+        return blk;
+    }
+    return arena_bump(a, size, ARENA_ALIGN);
+}
+
+// Hands a block back to its size-class free list; larger blocks are simply
+// abandoned until the arena is released.
+static void arena_free(Arena *a, void *p, size_t size) {
+    size = ARENA_ROUND(size);
+    if (!p || size > ARENA_SLAB_MAX) return;
+    *(void **)p = a->slab[size / ARENA_ALIGN];
+    a->slab[size / ARENA_ALIGN] = p;
+}
+
+static void arena_init(Arena *a, const PatrieAllocator *alloc) {
+    if (alloc) a->alloc = *alloc;
+    else { a->alloc.chunk_alloc = default_chunk_alloc; a->alloc.chunk_free = default_chunk_free; a->alloc.ctx = NULL; }
+    a->head = NULL;
+    a->next_chunk = ARENA_CHUNK_MIN;
+    memset(a->slab, 0, sizeof(a->slab));
+#ifdef PATRIE_STATS
+    a->allocs = a->alloc_bytes = a->chunks = a->chunk_bytes = 0;
+#endif
+}
+
+static void arena_release(Arena *a) {
+    ArenaChunk *c = a->head;
+    while (c) {
+        ArenaChunk *next = c->next;
+        a->alloc.chunk_free(c, ARENA_CHUNK_HDR + c->size, a->alloc.ctx);
+        c = next;
+    }
+    a->head = NULL;
+    memset(a->slab, 0, sizeof(a->slab));
+}
+
+// Strings come from the size classes so they can be handed back with
+// arena_free(p, strlen(p) + 1).
+static char *arena_strdup(Arena *a, const char *s) {
+    if (!s) return NULL;
+    size_t len = strlen(s) + 1;
+    char *p = arena_alloc(a, len);
+    memcpy(p, s, len);
+    return p;
+}
+
+// --------------------- Trie Node ---------------------
+// Edges are path-compressed: a node reached through key byte c also consumes
+// its `prefix` (plen bytes) before its own terminal flag and children, so a
+// chain of single-child nodes collapses into one labelled edge.
+// Children are kept in an adaptive radix layout: a node starts as a bare leaf
+// and is promoted to the next wider form when its child map fills up.
+//   NODE4 / NODE16  sorted key array + parallel child array
+//   NODE48          256-byte index into 48 child slots
+//   NODE256         direct child array indexed by the key byte
+typedef enum { NODE_LEAF, NODE4, NODE16, NODE48, NODE256 } NodeKind;
+
+typedef struct TrieNode {
+    uint8_t kind;
+    uint8_t terminal;
+    uint16_t count;
+    uint32_t plen;
+    const unsigned char *prefix;   // arena-owned by this node alone, immutable
+    PhenoId pid;                   // row in the phenotype columns when terminal
+    uint32_t gen;                  // generation that created the node (see Snapshots)
+    // Subtrie aggregates over this node and everything below it. They are upper
+    // bounds: raised on insert/lookup, never lowered when a score is overwritten.
+    double max_score;
+    uint64_t max_visits;
+    uint32_t qual_or;    // every flag some token below carries
+    uint32_t qual_and;   // flags every token below carries (~0 when none yet)
+} TrieNode;
+
+typedef struct { TrieNode n; unsigned char keys[4];  TrieNode *child[4];  } Node4;
+typedef struct { TrieNode n; unsigned char keys[16]; TrieNode *child[16]; } Node16;
+typedef struct { TrieNode n; uint8_t index[256];     TrieNode *child[48]; } Node48;   // index holds slot+1, 0 = empty
+typedef struct { TrieNode n; TrieNode *child[256]; } Node256;
+
+// --------------------- Phenotype columns ---------------------
+// Rows are grouped into fixed-size chunks holding one array per field, so a
+// pass over every score reads PHENO_CHUNK contiguous doubles at a time. Chunks
+// never move once allocated; only the chunk directory is reallocated, and the
+// old directory is retired like a node so lock-free readers stay safe.
+#define PHENO_CHUNK_SHIFT 10
+#define PHENO_CHUNK (1u << PHENO_CHUNK_SHIFT)
+
+typedef struct {
+    uint32_t dead;                         // deleted rows awaiting reuse; their fields are zeroed
+    uint64_t dead_mask[PHENO_CHUNK / 64];
+    double score[PHENO_CHUNK];
+    uint64_t visits[PHENO_CHUNK];
+    uint32_t qual[PHENO_CHUNK];
+    uint32_t gen[PHENO_CHUNK];             // generation that wrote the row
+    const char *meta[PHENO_CHUNK];
+} PhenoChunk;
+
+typedef struct {
+    PhenoChunk **dir;
+    uint32_t nchunks, dir_cap;
+    uint32_t count;   // rows ever allocated; ids are 0 .. count-1
+    PhenoId *free_ids;   // deleted ids, reused before count grows
+    uint32_t nfree, free_cap;
+    uint32_t held;       // dead rows kept intact (not zeroed) for snapshots
+    uint32_t dir_gen;    // generation that allocated dir
+} PhenoStore;
+
+// Meta strings are deduplicated: equal strings share one reference-counted
+// arena copy, found through a linear-probing table keyed by FNV-1a.
+typedef struct {
+    uint32_t refs;
+    uint32_t hash;
+    char s[];
+} InternStr;
+
+typedef struct {
+    const char **slot;   // InternStr::s of each entry
+    size_t cap, n;
+} InternPool;
+
+// --------------------- Concurrency ---------------------
+// Once patrie_enable_concurrent() is called, one writer may run patrie_insert
+// while any number of readers use patrie_lookup_shared() without locking:
+//   * nodes whose sorted arrays would shift, or whose label would be re-sliced,
+//     are copied and the copy is published with a release store;
+//   * NODE48/NODE256 slots and terminal flags are published in place;
+//   * replaced nodes are retired and recycled only after every reader that
+//     could still see them has left its read section (epoch-based reclamation).
+// Writers must still be serialised by the caller.
+#define PATRIE_MAX_READERS 64
+#define PATRIE_RETIRE_BATCH 64
+
+typedef struct {
+    _Alignas(64) uint64_t epoch;   // epoch announced on entry, 0 while quiescent
+    uint32_t depth;                // nesting of patrie_read_enter()
+    int in_use;
+} PatrieReader;
+
+typedef struct {
+    void *p;          // NULL: the entry retires row id instead of a block
+    size_t size;      // for a row id: non-zero if the row still holds its values
+    uint64_t epoch;
+    PhenoId id;
+    uint32_t born, gen;   // generation that created the block, and the one that retired it
+} Retired;
+
+// The root handed out by patrie_new() is embedded in the trie that owns the
+// arena, so every TrieNode* root can be mapped back to its allocator. It is a
+// NODE256 from the start and therefore never relocated by growth.
+typedef struct Patrie {
+    Node256 root;   // must stay first
+    Arena arena;
+    int concurrent;
+    uint64_t epoch;
+    Retired *retired;
+    size_t nretired, retired_cap;
+    size_t max_key;   // longest key ever inserted; bounds cursor stacks
+    PhenoStore pheno;
+    InternPool meta;
+    struct QualIndex *qidx;   // optional flag -> id bitmaps
+    struct HashIndex *hidx;   // optional key -> id hash table
+    int visits_stale;         // hashed lookups bumped visits without raising bounds
+    uint32_t gen;             // stamped on every node and row written
+    uint32_t snap_newest;     // generation of the newest live snapshot, 0 if none
+    struct Patrie *snaps;     // trie: its snapshots; snapshot: next one in that list
+    struct Patrie *origin;    // snapshot: the trie it was taken from, else NULL
+    uint32_t refs;            // snapshot: outstanding references
+    size_t live;              // snapshot: tokens it holds
+#ifdef PATRIE_STATS
+    PatrieStats stats;
+#endif
+    PatrieReader readers[PATRIE_MAX_READERS];
+} Patrie;
+
+static Patrie* patrie_of(TrieNode *root) { return (Patrie *)root; }
+
+// Records one point lookup that entered `nodes` nodes and passes found through.
+static int stat_lookup(Patrie *t, size_t nodes, int found) {
+#ifdef PATRIE_STATS
+    STAT_ADD(t->stats.lookups, 1);
+    STAT_ADD(t->stats.lookup_nodes, nodes);
+    if (!found) STAT_ADD(t->stats.lookup_misses, 1);
+#else
+    (void)t; (void)nodes;
+#endif
+    return found;
+}
+
+// A node or row created at generation born is still visible to some snapshot.
+static int gen_shared(const Patrie *t, uint32_t born) { return born <= t->snap_newest; }
+
+// --------------------- Child map ---------------------
+static const size_t node_size[] = {
+    [NODE_LEAF] = sizeof(TrieNode), [NODE4] = sizeof(Node4), [NODE16] = sizeof(Node16),
+    [NODE48] = sizeof(Node48), [NODE256] = sizeof(Node256),
+};
+
+static TrieNode* trie_node_new(Patrie *t, NodeKind kind) {
+    TrieNode *n = arena_alloc(&t->arena, node_size[kind]);
+    memset(n, 0, node_size[kind]);
+    n->kind = kind;
+    n->gen = t->gen;
+    n->max_score = -INFINITY;
+    n->qual_and = ~0u;
+    return n;
+}
+
+static void agg_absorb(TrieNode *dst, const TrieNode *src) {
+    if (src->max_score > dst->max_score) dst->max_score = src->max_score;
+    uint64_t v = __atomic_load_n(&src->max_visits, __ATOMIC_RELAXED);   // readers raise it concurrently
+    if (v > dst->max_visits) dst->max_visits = v;
+    dst->qual_or |= src->qual_or;
+    dst->qual_and &= src->qual_and;
+}
+
+// Field-wise so that readers raising max_visits concurrently are not torn.
+// The generation is not copied: the copy belongs to the current one.
+static void node_header_copy(TrieNode *dst, const TrieNode *src, NodeKind kind) {
+    dst->kind = kind;
+    dst->terminal = src->terminal;
+    dst->count = src->count;
+    dst->plen = src->plen;
+    dst->prefix = src->prefix;
+    dst->pid = src->pid;
+    dst->max_score = src->max_score;
+    dst->max_visits = __atomic_load_n(&src->max_visits, __ATOMIC_RELAXED);
+    dst->qual_or = src->qual_or;
+    dst->qual_and = src->qual_and;
+}
+
+static TrieNode** child_find(TrieNode *n, unsigned char key) {
+    switch (n->kind) {
+    case NODE4: {
+        Node4 *n4 = (Node4 *)n;
+        for (int i = 0; i < n->count; ++i)
+            if (n4->keys[i] == key) return &n4->child[i];
+        return NULL;
+    }
+    case NODE16: {
+        Node16 *n16 = (Node16 *)n;
+#ifdef __SSE2__
+        __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)key), _mm_loadu_si128((const __m128i *)n16->keys));
+        unsigned mask = (unsigned)_mm_movemask_epi8(cmp) & ((1u << n->count) - 1);
+        return mask ? &n16->child[__builtin_ctz(mask)] : NULL;
+#else
+        for (int i = 0; i < n->count; ++i)
+            if (n16->keys[i] == key) return &n16->child[i];
+        return NULL;
+#endif
+    }
+    case NODE48: {
+        Node48 *n48 = (Node48 *)n;
+        uint8_t idx = __atomic_load_n(&n48->index[key], __ATOMIC_ACQUIRE);
+        return idx ? &n48->child[idx - 1] : NULL;
+    }
+    case NODE256: {
+        Node256 *n256 = (Node256 *)n;
+        return __atomic_load_n(&n256->child[key], __ATOMIC_ACQUIRE) ? &n256->child[key] : NULL;
+    }
+    default:
+        return NULL;
+    }
+}
+
+// Copies n into a freshly allocated node of the same or the next wider kind.
+static TrieNode* node_clone(Patrie *t, TrieNode *n, NodeKind kind) {
+    TrieNode *g;
+    if (kind == n->kind) {
+        g = arena_alloc(&t->arena, node_size[kind]);
+        memcpy(g + 1, n + 1, node_size[kind] - sizeof(TrieNode));
+        node_header_copy(g, n, kind);
+        g->gen = t->gen;
+        return g;
+    }
+    switch (n->kind) {
+    case NODE_LEAF:
+        g = trie_node_new(t, NODE4);
+        break;
+    case NODE4: {
+        Node4 *n4 = (Node4 *)n;
+        Node16 *n16 = (Node16 *)(g = trie_node_new(t, NODE16));
+        memcpy(n16->keys, n4->keys, n->count);
+        memcpy(n16->child, n4->child, n->count * sizeof(TrieNode *));
+        break;
+    }
+    case NODE16: {
+        Node16 *n16 = (Node16 *)n;
+        Node48 *n48 = (Node48 *)(g = trie_node_new(t, NODE48));
+        for (int i = 0; i < n->count; ++i) {
+            n48->index[n16->keys[i]] = (uint8_t)(i + 1);
+            n48->child[i] = n16->child[i];
+        }
+        break;
+    }
+    default: {
+        Node48 *n48 = (Node48 *)n;
+        Node256 *n256 = (Node256 *)(g = trie_node_new(t, NODE256));
+        for (int k = 0; k < 256; ++k)
+            if (n48->index[k]) n256->child[k] = n48->child[n48->index[k] - 1];
+        break;
+    }
+    }
+    node_header_copy(g, n, (NodeKind)g->kind);
+    return g;
+}
+
+static void epoch_reclaim(Patrie *t);
+
+// A block unlinked by the writer goes straight back to the arena unless
+// readers or snapshots may still be traversing it.
+static void retire_push(Patrie *t, Retired r) {
+    if (t->nretired == t->retired_cap) {
+        t->retired_cap = t->retired_cap ? t->retired_cap * 2 : PATRIE_RETIRE_BATCH;
+        t->retired = realloc(t->retired, t->retired_cap * sizeof(Retired));
+        if (!t->retired) { perror("realloc"); exit(1); }
+    }
+    r.epoch = __atomic_load_n(&t->epoch, __ATOMIC_RELAXED);
+    r.gen = t->gen;
+    t->retired[t->nretired++] = r;
+    if (t->nretired % PATRIE_RETIRE_BATCH == 0) epoch_reclaim(t);
+}
+
+static void mem_retire(Patrie *t, void *p, size_t size, uint32_t born) {
+    if (!t->concurrent && !gen_shared(t, born)) { arena_free(&t->arena, p, size); return; }
+    retire_push(t, (Retired){ .p = p, .size = size, .id = PHENO_NONE, .born = born });
+}
+
+static void node_retire(Patrie *t, TrieNode *n) { mem_retire(t, n, node_size[n->kind], n->gen); }
+
+// Edge labels are owned by exactly one node, start at their allocation, and
+// come from the size classes; a shorter plen than allocated just recycles the
+// block into a smaller class.
+static unsigned char* label_new(Arena *a, const void *src, size_t len) {
+    if (!len) return NULL;
+    unsigned char *label = arena_alloc(a, len);
+    memcpy(label, src, len);
+    return label;
+}
+
+// born is the generation of the node that owned the label.
+static void label_free(Patrie *t, const unsigned char *label, size_t len, uint32_t born) {
+    if (label && len) mem_retire(t, (void *)label, len, born);
+}
+
+// Path copying: a node still visible to a snapshot is replaced by a private
+// copy, label included, before the writer changes it or anything below it.
+static TrieNode* node_unshare(Patrie *t, TrieNode **ref, TrieNode *n) {
+    TrieNode *g = node_clone(t, n, (NodeKind)n->kind);
+    STAT_ADD(t->stats.path_copies, 1);
+    g->prefix = label_new(&t->arena, n->prefix, n->plen);
+    __atomic_store_n(ref, g, __ATOMIC_RELEASE);
+    label_free(t, n->prefix, n->plen, n->gen);
+    node_retire(t, n);
+    return g;
+}
+
+static int node_full(const TrieNode *n) {
+    switch (n->kind) {
+    case NODE_LEAF: return 1;
+    case NODE4:     return n->count == 4;
+    case NODE16:    return n->count == 16;
+    case NODE48:    return n->count == 48;
+    default:        return 0;
+    }
+}
+
+// Adds a child under a key that is not yet present. *ref is the slot holding the
+// node in its parent and is rewritten when the node has to grow (or, for
+// concurrent readers, when a sorted array has to shift).
+static void child_add(Patrie *t, TrieNode **ref, unsigned char key, TrieNode *child) {
+    TrieNode *old = *ref, *n = old;
+    if (node_full(old)) {
+        n = node_clone(t, old, (NodeKind)(old->kind + 1));
+        STAT_ADD(t->stats.node_grows, 1);
+    } else if (t->concurrent && old->kind <= NODE16) n = node_clone(t, old, (NodeKind)old->kind);
+    switch (n->kind) {
+    case NODE4:
+    case NODE16: {
+        unsigned char *keys = n->kind == NODE4 ? ((Node4 *)n)->keys : ((Node16 *)n)->keys;
+        TrieNode **kids = n->kind == NODE4 ? ((Node4 *)n)->child : ((Node16 *)n)->child;
+        int i = n->count;
+        while (i > 0 && keys[i - 1] > key) { keys[i] = keys[i - 1]; kids[i] = kids[i - 1]; --i; }
+        keys[i] = key; kids[i] = child;
+        break;
+    }
+    case NODE48: {
+        Node48 *n48 = (Node48 *)n;
+        n48->child[n->count] = child;
+        __atomic_store_n(&n48->index[key], (uint8_t)(n->count + 1), __ATOMIC_RELEASE);
+        break;
+    }
+    default:
+        __atomic_store_n(&((Node256 *)n)->child[key], child, __ATOMIC_RELEASE);
+        break;
+    }
+    n->count++;
+    if (n != old) {
+        __atomic_store_n(ref, n, __ATOMIC_RELEASE);
+        node_retire(t, old);
+    }
+}
+
+typedef void (*child_visit_fn)(unsigned char key, TrieNode *child, void *ctx);
+
+// Visits children in ascending key order.
+static void child_foreach(TrieNode *n, child_visit_fn fn, void *ctx) {
+    switch (n->kind) {
+    case NODE4:
+        for (int i = 0; i < n->count; ++i) fn(((Node4 *)n)->keys[i], ((Node4 *)n)->child[i], ctx);
+        break;
+    case NODE16:
+        for (int i = 0; i < n->count; ++i) fn(((Node16 *)n)->keys[i], ((Node16 *)n)->child[i], ctx);
+        break;
+    case NODE48: {
+        Node48 *n48 = (Node48 *)n;
+        for (int k = 0; k < 256; ++k)
+            if (n48->index[k]) fn((unsigned char)k, n48->child[n48->index[k] - 1], ctx);
+        break;
+    }
+    case NODE256:
+        for (int k = 0; k < 256; ++k)
+            if (((Node256 *)n)->child[k]) fn((unsigned char)k, ((Node256 *)n)->child[k], ctx);
+        break;
+    default:
+        break;
+    }
+}
+
+// --------------------- Qualifier bitmaps ---------------------
+// Roaring-style id sets: ids are split on their high 16 bits into containers
+// that hold the low halves as a sorted array while sparse and switch to a
+// 65536-bit bitmap once they hold more than ROAR_ARRAY_MAX entries.
+#define ROAR_ARRAY_MAX 4096
+#define ROAR_WORDS     1024
+#define QUAL_BITS      32
+
+typedef struct {
+    uint16_t key;
+    uint32_t card;
+    uint32_t cap;
+    uint16_t *array;
+    uint64_t *words;
+} RoarContainer;
+
+typedef struct {
+    RoarContainer *c;
+    size_t n, cap;
+} RoarBitmap;
+
+static size_t roar_lower(const RoarBitmap *b, uint16_t key) {
+    size_t lo = 0, hi = b->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (b->c[mid].key < key) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static RoarContainer* roar_find(const RoarBitmap *b, uint16_t key) {
+    size_t lo = roar_lower(b, key);
+    return lo < b->n && b->c[lo].key == key ? &b->c[lo] : NULL;
+}
+
+static RoarContainer* roar_get(RoarBitmap *b, uint16_t key) {
+    size_t lo = roar_lower(b, key);
+    if (lo < b->n && b->c[lo].key == key) return &b->c[lo];
+    if (b->n == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 4;
+        b->c = realloc(b->c, b->cap * sizeof(RoarContainer));
+        if (!b->c) { perror("realloc"); exit(1); }
+    }
+    memmove(&b->c[lo + 1], &b->c[lo], (b->n - lo) * sizeof(RoarContainer));
+    b->n++;
+    b->c[lo] = (RoarContainer){ .key = key };
+    return &b->c[lo];
+}
+
+static void roar_add(RoarBitmap *b, uint32_t x) {
+    RoarContainer *c = roar_get(b, (uint16_t)(x >> 16));
+    uint16_t lo = (uint16_t)x;
+    if (c->words) {
+        if (!(c->words[lo >> 6] & (1ull << (lo & 63)))) { c->words[lo >> 6] |= 1ull << (lo & 63); c->card++; }
+        return;
+    }
+    uint32_t i = 0;
+    while (i < c->card && c->array[i] < lo) ++i;
+    if (i < c->card && c->array[i] == lo) return;
+    if (c->card == ROAR_ARRAY_MAX) {
+        c->words = calloc(ROAR_WORDS, sizeof(uint64_t));
+        if (!c->words) { perror("calloc"); exit(1); }
+        for (uint32_t k = 0; k < c->card; ++k) c->words[c->array[k] >> 6] |= 1ull << (c->array[k] & 63);
+        c->words[lo >> 6] |= 1ull << (lo & 63);
+        c->card++;
+        free(c->array); c->array = NULL;
+        return;
+    }
+    if (c->card == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 8;
+        c->array = realloc(c->array, c->cap * sizeof(uint16_t));
+        if (!c->array) { perror("realloc"); exit(1); }
+    }
+    memmove(&c->array[i + 1], &c->array[i], (c->card - i) * sizeof(uint16_t));
+    c->array[i] = lo;
+    c->card++;
+}
+
+static void roar_remove(RoarBitmap *b, uint32_t x) {
+    RoarContainer *c = roar_find(b, (uint16_t)(x >> 16));
+    uint16_t lo = (uint16_t)x;
+    if (!c) return;
+    if (c->words) {
+        if (c->words[lo >> 6] & (1ull << (lo & 63))) { c->words[lo >> 6] &= ~(1ull << (lo & 63)); c->card--; }
+        return;
+    }
+    for (uint32_t i = 0; i < c->card; ++i)
+        if (c->array[i] == lo) {
+            memmove(&c->array[i], &c->array[i + 1], (c->card - i - 1) * sizeof(uint16_t));
+            c->card--;
+            return;
+        }
+}
+
+static void roar_words(const RoarContainer *c, uint64_t *w) {
+    if (c->words) { memcpy(w, c->words, ROAR_WORDS * sizeof(uint64_t)); return; }
+    memset(w, 0, ROAR_WORDS * sizeof(uint64_t));
+    for (uint32_t i = 0; i < c->card; ++i) w[c->array[i] >> 6] |= 1ull << (c->array[i] & 63);
+}
+
+static uint64_t roar_card(const RoarBitmap *b) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < b->n; ++i) n += b->c[i].card;
+    return n;
+}
+
+static void roar_free(RoarBitmap *b) {
+    for (size_t i = 0; i < b->n; ++i) { free(b->c[i].array); free(b->c[i].words); }
+    free(b->c);
+}
+
+// Per-flag id sets plus the id -> token directory needed to report matches.
+typedef struct QualIndex {
+    RoarBitmap live;
+    RoarBitmap flag[QUAL_BITS];
+    const char **key;
+    size_t cap;
+} QualIndex;
+
+static void qidx_add(Patrie *t, const char *key, PhenoId id, uint32_t qual) {
+    QualIndex *qi = t->qidx;
+    if (id >= qi->cap) {
+        size_t nc = qi->cap ? qi->cap : 1024;
+        while (nc <= id) nc *= 2;
+        qi->key = realloc(qi->key, nc * sizeof(const char *));
+        if (!qi->key) { perror("realloc"); exit(1); }
+        qi->cap = nc;
+    }
+    qi->key[id] = arena_strdup(&t->arena, key);
+    roar_add(&qi->live, id);
+    for (int bit = 0; bit < QUAL_BITS; ++bit)
+        if (qual & (1u << bit)) roar_add(&qi->flag[bit], id);
+}
+
+static void qidx_remove(Patrie *t, PhenoId id, uint32_t qual) {
+    QualIndex *qi = t->qidx;
+    roar_remove(&qi->live, id);
+    for (int bit = 0; bit < QUAL_BITS; ++bit)
+        if (qual & (1u << bit)) roar_remove(&qi->flag[bit], id);
+    arena_free(&t->arena, (void *)qi->key[id], strlen(qi->key[id]) + 1);
+    qi->key[id] = NULL;
+}
+
+static void qidx_requal(QualIndex *qi, uint32_t id, uint32_t old, uint32_t now) {
+    for (int bit = 0; bit < QUAL_BITS; ++bit) {
+        uint32_t m = 1u << bit;
+        if ((old & m) && !(now & m)) roar_remove(&qi->flag[bit], id);
+        else if (!(old & m) && (now & m)) roar_add(&qi->flag[bit], id);
+    }
+}
+
+static void qidx_free(QualIndex *qi) {
+    if (!qi) return;
+    roar_free(&qi->live);
+    for (int bit = 0; bit < QUAL_BITS; ++bit) roar_free(&qi->flag[bit]);
+    free(qi->key);
+    free(qi);
+}
+
+// --------------------- Hash index ---------------------
+// Optional exact-match side index from key to row id, in the style of a Swiss
+// table: a control byte per slot holds the low 7 hash bits (or EMPTY/DELETED),
+// and probing tests a whole group of 16 control bytes with one SIMD compare.
+// Groups are probed triangularly, which visits every group of a power-of-two
+// table. The trie stays the ordered store; the index only answers point lookups.
+#define HIDX_GROUP   16
+#define HIDX_EMPTY   ((int8_t)-128)
+#define HIDX_DELETED ((int8_t)-2)
+
+typedef struct {
+    const char *key;   // arena copy
+    PhenoId id;
+} HashSlot;
+
+typedef struct HashIndex {
+    int8_t *ctrl;
+    HashSlot *slot;
+    size_t cap;   // power of two, a multiple of HIDX_GROUP
+    size_t n, tomb;
+} HashIndex;
+
+// FNV-1a
+static uint64_t str_hash(const char *s) {
+    uint64_t h = 1469598103934665603ull;
+    while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211ull; }
+    return h;
+}
+
+// Bit i set where group byte i equals b.
+static unsigned hidx_match(const int8_t *g, int8_t b) {
+#ifdef __SSE2__
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(b), _mm_loadu_si128((const __m128i *)g)));
+#else
+    unsigned m = 0;
+    for (int i = 0; i < HIDX_GROUP; ++i) m |= (unsigned)(g[i] == b) << i;
+    return m;
+#endif
+}
+
+// Bit i set where group slot i is EMPTY or DELETED (the only negative bytes).
+static unsigned hidx_match_free(const int8_t *g) {
+#ifdef __SSE2__
+    return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+#else
+    unsigned m = 0;
+    for (int i = 0; i < HIDX_GROUP; ++i) m |= (unsigned)(g[i] < 0) << i;
+    return m;
+#endif
+}
+
+static size_t hidx_group(const HashIndex *hx, uint64_t h) { return (h >> 7) & (hx->cap / HIDX_GROUP - 1); }
+
+static HashSlot* hidx_find(const HashIndex *hx, const char *key, uint64_t h) {
+    size_t gmask = hx->cap / HIDX_GROUP - 1, g = hidx_group(hx, h);
+    for (size_t step = 1;; ++step) {
+        const int8_t *ctrl = hx->ctrl + g * HIDX_GROUP;
+        for (unsigned m = hidx_match(ctrl, (int8_t)(h & 0x7f)); m; m &= m - 1) {
+            HashSlot *s = &hx->slot[g * HIDX_GROUP + __builtin_ctz(m)];
+            if (strcmp(s->key, key) == 0) return s;
+        }
+        if (hidx_match(ctrl, HIDX_EMPTY)) return NULL;
+        g = (g + step) & gmask;
+    }
+}
+
+// Claims a free slot for a key known to be absent.
+static HashSlot* hidx_claim(HashIndex *hx, uint64_t h) {
+    size_t gmask = hx->cap / HIDX_GROUP - 1, g = hidx_group(hx, h);
+    for (size_t step = 1;; ++step) {
+        unsigned m = hidx_match_free(hx->ctrl + g * HIDX_GROUP);
+        if (m) {
+            size_t i = g * HIDX_GROUP + __builtin_ctz(m);
+            if (hx->ctrl[i] == HIDX_DELETED) hx->tomb--;
+            hx->ctrl[i] = (int8_t)(h & 0x7f);
+            hx->n++;
+            return &hx->slot[i];
+        }
+        g = (g + step) & gmask;
+    }
+}
+
+// Re-sizes for want live entries at most 7/8 full, dropping tombstones.
+static void hidx_rehash(HashIndex *hx, size_t want) {
+    size_t cap = HIDX_GROUP;
+    while (cap * 7 < want * 8) cap *= 2;
+    int8_t *ctrl = hx->ctrl;
+    HashSlot *slot = hx->slot;
+    size_t old = hx->cap;
+    hx->ctrl = malloc(cap);
+    hx->slot = malloc(cap * sizeof(HashSlot));
+    if (!hx->ctrl || !hx->slot) { perror("malloc"); exit(1); }
+    memset(hx->ctrl, HIDX_EMPTY, cap);
+    hx->cap = cap;
+    hx->n = hx->tomb = 0;
+    for (size_t i = 0; i < old; ++i)
+        if (ctrl[i] >= 0) *hidx_claim(hx, str_hash(slot[i].key)) = slot[i];
+    free(ctrl);
+    free(slot);
+}
+
+// Points key at id, adding it if new.
+static void hidx_put(Patrie *t, const char *key, PhenoId id) {
+    HashIndex *hx = t->hidx;
+    uint64_t h = str_hash(key);
+    HashSlot *s = hidx_find(hx, key, h);
+    if (s) { s->id = id; return; }
+    if ((hx->n + hx->tomb + 1) * 8 > hx->cap * 7) hidx_rehash(hx, 2 * (hx->n + 1));
+    s = hidx_claim(hx, h);
+    s->key = arena_strdup(&t->arena, key);
+    s->id = id;
+}
+
+static void hidx_remove(Patrie *t, const char *key) {
+    HashIndex *hx = t->hidx;
+    HashSlot *s = hidx_find(hx, key, str_hash(key));
+    if (!s) return;
+    hx->ctrl[s - hx->slot] = HIDX_DELETED;
+    hx->tomb++;
+    hx->n--;
+    arena_free(&t->arena, (void *)s->key, strlen(s->key) + 1);
+}
+
+static void hidx_free(HashIndex *hx) {
+    if (!hx) return;
+    free(hx->ctrl);
+    free(hx->slot);
+    free(hx);
+}
+
+// --------------------- Trie + Phenotype ---------------------
+static InternStr* intern_hdr(const char *s) { return (InternStr *)(s - offsetof(InternStr, s)); }
+
+static void intern_grow(InternPool *ip) {
+    size_t nc = ip->cap ? ip->cap * 2 : 64;
+    const char **slot = calloc(nc, sizeof(const char *));
+    if (!slot) { perror("calloc"); exit(1); }
+    for (size_t i = 0; i < ip->cap; ++i) {
+        if (!ip->slot[i]) continue;
+        size_t j = intern_hdr(ip->slot[i])->hash & (nc - 1);
+        while (slot[j]) j = (j + 1) & (nc - 1);
+        slot[j] = ip->slot[i];
+    }
+    free(ip->slot);
+    ip->slot = slot; ip->cap = nc;
+}
+
+// Returns the shared copy of s with refs references added.
+static const char* intern_n(Patrie *t, const char *s, uint32_t refs) {
+    if (!s) return NULL;
+    InternPool *ip = &t->meta;
+    if (2 * (ip->n + 1) > ip->cap) intern_grow(ip);
+    uint32_t h = (uint32_t)str_hash(s);
+    size_t j = h & (ip->cap - 1);
+    while (ip->slot[j]) {
+        InternStr *is = intern_hdr(ip->slot[j]);
+        if (is->hash == h && strcmp(is->s, s) == 0) { is->refs += refs; return is->s; }
+        j = (j + 1) & (ip->cap - 1);
+    }
+    size_t len = strlen(s) + 1;
+    InternStr *is = arena_alloc(&t->arena, sizeof(InternStr) + len);
+    is->refs = refs; is->hash = h;
+    memcpy(is->s, s, len);
+    ip->n++;
+    return ip->slot[j] = is->s;
+}
+
+static const char* intern(Patrie *t, const char *s) { return intern_n(t, s, 1); }
+
+// Drops one reference. The last one removes the string with backward-shift
+// deletion; in concurrent mode strings are kept, since readers may hold them
+// past their read section.
+static void intern_unref(Patrie *t, const char *s) {
+    if (!s) return;
+    InternStr *is = intern_hdr(s);
+    if (--is->refs || t->concurrent) return;
+    InternPool *ip = &t->meta;
+    size_t mask = ip->cap - 1, i = is->hash & mask;
+    while (ip->slot[i] != s) i = (i + 1) & mask;
+    ip->slot[i] = NULL;
+    for (size_t j = (i + 1) & mask; ip->slot[j]; j = (j + 1) & mask) {
+        size_t home = intern_hdr(ip->slot[j])->hash & mask;
+        // move j back into the hole unless its home lies cyclically in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) { ip->slot[i] = ip->slot[j]; ip->slot[j] = NULL; i = j; }
+    }
+    ip->n--;
+    arena_free(&t->arena, is, sizeof(InternStr) + strlen(s) + 1);
+}
+
+static PhenoChunk* pheno_chunk(const Patrie *t, PhenoId id) {
+    PhenoChunk **dir = __atomic_load_n(&t->pheno.dir, __ATOMIC_ACQUIRE);
+    return dir[id >> PHENO_CHUNK_SHIFT];
+}
+
+#define PHENO_SLOT(id) ((id) & (PHENO_CHUNK - 1))
+
+// Ensures chunks exist for rows up to count + rows without publishing them.
+static void pheno_reserve(Patrie *t, size_t rows) {
+    PhenoStore *ps = &t->pheno;
+    size_t need = ((size_t)ps->count + rows + PHENO_CHUNK - 1) >> PHENO_CHUNK_SHIFT;
+    if (ps->count + rows > PHENO_NONE) { fprintf(stderr, "patrie: phenotype ids exhausted\n"); exit(1); }
+    if (need > ps->dir_cap) {
+        uint32_t nc = ps->dir_cap ? ps->dir_cap : 8;
+        while (nc < need) nc *= 2;
+        PhenoChunk **dir = arena_alloc(&t->arena, nc * sizeof(PhenoChunk *));
+        if (ps->nchunks) memcpy(dir, ps->dir, ps->nchunks * sizeof(PhenoChunk *));
+        PhenoChunk **old = ps->dir;
+        __atomic_store_n(&ps->dir, dir, __ATOMIC_RELEASE);
+        if (old) mem_retire(t, old, ps->dir_cap * sizeof(PhenoChunk *), ps->dir_gen);
+        ps->dir_cap = nc;
+        ps->dir_gen = t->gen;
+    }
+    while (ps->nchunks < need) {
+        PhenoChunk *c = arena_bump(&t->arena, sizeof(PhenoChunk), ARENA_ALIGN);
+        c->dead = 0;
+        memset(c->dead_mask, 0, sizeof(c->dead_mask));
+        ps->dir[ps->nchunks++] = c;
+    }
+}
+
+static void pheno_free_push(PhenoStore *ps, PhenoId id) {
+    if (ps->nfree == ps->free_cap) {
+        ps->free_cap = ps->free_cap ? ps->free_cap * 2 : 64;
+        ps->free_ids = realloc(ps->free_ids, ps->free_cap * sizeof(PhenoId));
+        if (!ps->free_ids) { perror("realloc"); exit(1); }
+    }
+    ps->free_ids[ps->nfree++] = id;
+}
+
+// Takes a deleted id if one is free, else appends a row. The row is filled
+// before the caller publishes its id through a terminal node, so readers never
+// see it half written.
+static PhenoId pheno_new(Patrie *t, double score, QualFlags qual, const char *meta) {
+    PhenoStore *ps = &t->pheno;
+    PhenoId id;
+    if (ps->nfree) id = ps->free_ids[--ps->nfree];
+    else { pheno_reserve(t, 1); id = ps->count++; }
+    PhenoChunk *c = ps->dir[id >> PHENO_CHUNK_SHIFT];
+    uint32_t k = PHENO_SLOT(id);
+    if (c->dead_mask[k >> 6] & (1ull << (k & 63))) { c->dead_mask[k >> 6] &= ~(1ull << (k & 63)); c->dead--; }
+    c->score[k] = score;
+    c->visits[k] = 0;
+    c->qual[k] = (uint32_t)qual;
+    c->gen[k] = t->gen;
+    c->meta[k] = intern(t, meta);
+    return id;
+}
+
+// Relaxed stores keep concurrent readers from seeing torn fields; in concurrent
+// mode interned strings are never freed, so a reader holding the old one stays
+// valid. An unchanged meta string is kept without going through the table.
+static void pheno_update(Patrie *t, PhenoId id, double score, QualFlags qual, const char *meta) {
+    PhenoChunk *c = pheno_chunk(t, id);
+    uint32_t k = PHENO_SLOT(id);
+    if (t->qidx && c->qual[k] != (uint32_t)qual) qidx_requal(t->qidx, id, c->qual[k], (uint32_t)qual);
+    const char *cur = c->meta[k];
+    const char *m = cur;
+    if (meta != cur && !(meta && cur && strcmp(meta, cur) == 0)) {
+        m = intern(t, meta);
+        intern_unref(t, cur);
+    }
+    if (!t->concurrent) {
+        c->score[k] = score;
+        c->qual[k] = (uint32_t)qual;
+        c->meta[k] = m;
+        return;
+    }
+    __atomic_store(&c->score[k], &score, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->qual[k], (uint32_t)qual, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->meta[k], m, __ATOMIC_RELEASE);
+}
+
+// Materialises one row. Loads are relaxed atomics so the same path serves
+// lock-free readers.
+static void pheno_load(const Patrie *t, PhenoId id, Phenotype *out) {
+    PhenoChunk *c = pheno_chunk(t, id);
+    uint32_t k = PHENO_SLOT(id);
+    __atomic_load(&c->score[k], &out->score, __ATOMIC_RELAXED);
+    out->visits = __atomic_load_n(&c->visits[k], __ATOMIC_RELAXED);
+    out->qual = (QualFlags)__atomic_load_n(&c->qual[k], __ATOMIC_RELAXED);
+    out->id = id;
+    out->meta = __atomic_load_n(&c->meta[k], __ATOMIC_ACQUIRE);
+}
+
+static uint32_t pheno_qual(const Patrie *t, PhenoId id) {
+    return __atomic_load_n(&pheno_chunk(t, id)->qual[PHENO_SLOT(id)], __ATOMIC_RELAXED);
+}
+
+// Single writer: a relaxed load/store pair, so snapshot readers may load the
+// counter concurrently.
+static uint64_t pheno_visit(Patrie *t, PhenoId id) {
+    uint64_t *v = &pheno_chunk(t, id)->visits[PHENO_SLOT(id)];
+    uint64_t n = __atomic_load_n(v, __ATOMIC_RELAXED) + 1;
+    __atomic_store_n(v, n, __ATOMIC_RELAXED);
+    return n;
+}
+
+static int pheno_dead(const Patrie *t, PhenoId id) {
+    const PhenoChunk *c = pheno_chunk(t, id);
+    return (c->dead_mask[PHENO_SLOT(id) >> 6] >> (PHENO_SLOT(id) & 63)) & 1;
+}
+
+// Zeroes a dead row so column kernels can run over its chunk and correct for
+// the dead rows afterwards.
+static void pheno_zero(Patrie *t, PhenoChunk *c, uint32_t k) {
+    static const double zero = 0;
+    intern_unref(t, c->meta[k]);
+    __atomic_store(&c->score[k], &zero, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->visits[k], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->qual[k], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->meta[k], NULL, __ATOMIC_RELEASE);
+    c->dead++;
+}
+
+// Frees the row of a deleted or superseded token. The id is reused once no
+// concurrent reader can still be looking at it; a row a snapshot still reads
+// is left whole (held) until that snapshot is gone.
+static void pheno_release(Patrie *t, PhenoId id) {
+    PhenoChunk *c = pheno_chunk(t, id);
+    uint32_t k = PHENO_SLOT(id);
+    if (t->qidx) qidx_remove(t, id, c->qual[k]);
+    c->dead_mask[k >> 6] |= 1ull << (k & 63);
+    if (gen_shared(t, c->gen[k])) {
+        t->pheno.held++;
+        retire_push(t, (Retired){ .p = NULL, .size = 1, .id = id, .born = c->gen[k] });
+        return;
+    }
+    pheno_zero(t, c, k);
+    if (t->concurrent) retire_push(t, (Retired){ .p = NULL, .id = id, .born = c->gen[k] });
+    else pheno_free_push(&t->pheno, id);
+}
+
+// Copies row id into *out; returns 0 if no such row exists. Ids name rows of
+// the live trie only, so snapshots have none.
+int patrie_pheno(TrieNode *root, PhenoId id, Phenotype *out) {
+    Patrie *t = patrie_of(root);
+    if (t->origin || id >= t->pheno.count || pheno_dead(t, id)) return 0;
+    pheno_load(t, id, out);
+    return 1;
+}
+
+// Live rows, i.e. tokens in the trie.
+size_t patrie_pheno_count(TrieNode *root) {
+    const PhenoStore *ps = &patrie_of(root)->pheno;
+    size_t dead = 0;
+    if (patrie_of(root)->origin) return patrie_of(root)->live;
+    for (uint32_t c = 0; c < ps->nchunks; ++c) dead += ps->dir[c]->dead;
+    return ps->count - dead - ps->held;
+}
+
+TrieNode* patrie_new_with(const PatrieAllocator *alloc) {
+    size_t size = (sizeof(Patrie) + 63) & ~(size_t)63;
+    Patrie *t = aligned_alloc(64, size);
+    if (!t) { perror("aligned_alloc"); exit(1); }
+    memset(t, 0, sizeof(Patrie));
+    t->root.n.kind = NODE256;
+    t->epoch = 1;
+    t->gen = 1;
+    arena_init(&t->arena, alloc);
+    return &t->root.n;
+}
+
+TrieNode* patrie_new(void) { return patrie_new_with(NULL); }
+
+// Copies the counters into *out; returns 0 (with *out zeroed) unless built
+// with PATRIE_STATS. Averages are left to the caller, e.g. nodes per lookup
+// is lookup_nodes / lookups.
+int patrie_stats(TrieNode *root, PatrieStats *out) {
+    memset(out, 0, sizeof(*out));
+#ifdef PATRIE_STATS
+    Patrie *t = patrie_of(root);
+    uint64_t *dst = (uint64_t *)out, *src = (uint64_t *)&t->stats;
+    for (size_t k = 0; k < sizeof(PatrieStats) / sizeof(uint64_t); ++k) dst[k] = __atomic_load_n(&src[k], __ATOMIC_RELAXED);
+    out->allocs = t->arena.allocs;
+    out->alloc_bytes = t->arena.alloc_bytes;
+    out->chunks = t->arena.chunks;
+    out->chunk_bytes = t->arena.chunk_bytes;
+    return 1;
+#else
+    (void)root;
+    return 0;
+#endif
+}
+
+void patrie_stats_reset(TrieNode *root) {
+#ifdef PATRIE_STATS
+    Patrie *t = patrie_of(root);
+    memset(&t->stats, 0, sizeof(t->stats));
+    t->arena.allocs = t->arena.alloc_bytes = t->arena.chunks = t->arena.chunk_bytes = 0;
+#else
+    (void)root;
+#endif
+}
+
+// Adds a staged trie's counters to the one it is merged into.
+static void stats_absorb(Patrie *t, const Patrie *from) {
+#ifdef PATRIE_STATS
+    uint64_t *dst = (uint64_t *)&t->stats;
+    const uint64_t *src = (const uint64_t *)&from->stats;
+    for (size_t k = 0; k < sizeof(PatrieStats) / sizeof(uint64_t); ++k) STAT_ADD(dst[k], src[k]);
+#else
+    (void)t; (void)from;
+#endif
+}
+
+static TrieNode* leaf_new(Patrie *t, const char *rest) {
+    TrieNode *n = trie_node_new(t, NODE_LEAF);
+    size_t len = strlen(rest);
+    n->prefix = label_new(&t->arena, rest, len);
+    n->plen = (uint32_t)len;
+    return n;
+}
+
+// Length of the common run of key and a node label; key may end early.
+static uint32_t prefix_match(const unsigned char *prefix, uint32_t plen, const char *key) {
+    uint32_t j = 0;
+    while (j < plen && (unsigned char)key[j] == prefix[j]) ++j;
+    return j;
+}
+
+// Lookups and inserts remember the nodes they passed so aggregates can be
+// raised on the way back up; deeper paths fall back to a second walk from the
+// root.
+#define PATRIE_PATH_MAX 32
+
+// Walks key, adding missing nodes and splitting labels, and returns the node
+// that ends it. path records the nodes from the root down as they stand once
+// any copy-on-write replacement has been published.
+static TrieNode* insert_walk(Patrie *t, const char *key, TrieNode **path, size_t *depth) {
+    TrieNode *cur = &t->root.n;
+    TrieNode **ref = &cur;   // the root is a NODE256 and never moves
+    size_t i = 0;
+    *depth = 0;
+    path[(*depth)++] = cur;
+    while (key[i] != '\0') {
+        unsigned char ch = (unsigned char)key[i];
+        TrieNode **slot = child_find(cur, ch);
+        if (!slot) {
+            TrieNode *leaf = leaf_new(t, key + i + 1);
+            child_add(t, ref, ch, leaf);
+            if (*depth <= PATRIE_PATH_MAX) path[*depth - 1] = *ref;
+            cur = leaf;
+            if (*depth < PATRIE_PATH_MAX) path[*depth] = cur;
+            (*depth)++;
+            break;
+        }
+        TrieNode *child = *slot;
+        if (gen_shared(t, child->gen)) child = node_unshare(t, slot, child);
+        ++i;
+        uint32_t j = prefix_match(child->prefix, child->plen, key + i);
+        if (j < child->plen) {
+            // split the edge: mid keeps the label buffer for the shared part,
+            // the tail gets a copy of the rest
+            TrieNode *mid = trie_node_new(t, NODE4);
+            STAT_ADD(t->stats.edge_splits, 1);
+            agg_absorb(mid, child);
+            TrieNode *tail = t->concurrent ? node_clone(t, child, (NodeKind)child->kind) : child;
+            const unsigned char *label = child->prefix;
+            unsigned char split = label[j];
+            tail->prefix = label_new(&t->arena, label + j + 1, child->plen - j - 1);
+            tail->plen = child->plen - j - 1;
+            if (j) { mid->prefix = label; mid->plen = j; }
+            else label_free(t, label, j + 1 + tail->plen, child->gen);
+            Node4 *m4 = (Node4 *)mid;
+            m4->keys[0] = split; m4->child[0] = tail; mid->count = 1;
+            __atomic_store_n(slot, mid, __ATOMIC_RELEASE);
+            if (tail != child) node_retire(t, child);
+            child = mid;
+        }
+        ref = slot;
+        cur = child;
+        i += j;
+        if (*depth < PATRIE_PATH_MAX) path[*depth] = cur;
+        (*depth)++;
+    }
+    size_t klen = i + strlen(key + i);
+    if (klen > t->max_key) t->max_key = klen;
+    return cur;
+}
+
+static void agg_note(TrieNode *n, double score, uint32_t qual) {
+    if (score > n->max_score) n->max_score = score;
+    n->qual_or |= qual; n->qual_and &= qual;
+}
+
+// Folds a stored value into the aggregates of every node on key's path.
+static void agg_raise_insert(TrieNode *root, const char *key, TrieNode **path, size_t depth,
+                             double score, uint32_t qual) {
+    if (depth <= PATRIE_PATH_MAX) {
+        for (size_t d = 0; d < depth; ++d) agg_note(path[d], score, qual);
+        return;
+    }
+    TrieNode *cur = root;
+    size_t i = 0;
+    for (;;) {
+        agg_note(cur, score, qual);
+        if (key[i] == '\0') return;
+        cur = *child_find(cur, (unsigned char)key[i]);
+        i += 1 + cur->plen;
+    }
+}
+
+static void terminal_publish(Patrie *t, TrieNode *n, const char *key, PhenoId id) {
+    if (t->qidx) qidx_add(t, key, id, pheno_qual(t, id));
+    if (t->hidx) hidx_put(t, key, id);
+    __atomic_store_n(&n->pid, id, __ATOMIC_RELEASE);
+    __atomic_store_n(&n->terminal, 1, __ATOMIC_RELEASE);
+}
+
+// Moves n's row to a fresh id before it is modified if a snapshot still reads it.
+static void row_unshare(Patrie *t, TrieNode *n, const char *key) {
+    PhenoChunk *c = pheno_chunk(t, n->pid);
+    uint32_t k = PHENO_SLOT(n->pid);
+    if (!gen_shared(t, c->gen[k])) return;
+    PhenoId old = n->pid;
+    PhenoId id = pheno_new(t, c->score[k], (QualFlags)c->qual[k], c->meta[k]);
+    pheno_chunk(t, id)->visits[PHENO_SLOT(id)] = __atomic_load_n(&c->visits[k], __ATOMIC_RELAXED);
+    terminal_publish(t, n, key, id);
+    pheno_release(t, old);
+}
+
+void patrie_insert(TrieNode *root, const char *key, double score, QualFlags qual, const char *meta) {
+    Patrie *t = patrie_of(root);
+    TrieNode *path[PATRIE_PATH_MAX];
+    size_t depth;
+    TrieNode *n = insert_walk(t, key, path, &depth);
+    agg_raise_insert(root, key, path, depth, score, (uint32_t)qual);
+    if (!n->terminal) terminal_publish(t, n, key, pheno_new(t, score, qual, meta));
+    else { row_unshare(t, n, key); pheno_update(t, n->pid, score, qual, meta); }
+}
+
+// Called with the current row of an existing key (created = 0) or with a
+// zeroed row for a new one (created = 1); score, qual and meta are stored back
+// as left by the function. visits and id are read-only.
+typedef void (*combine_fn)(Phenotype *row, int created, void *ctx);
+
+// Insert-or-merge in a single walk. meta is re-interned only if combine
+// changed it. Returns 1 if the key was created, 0 if it was merged.
+int patrie_upsert(TrieNode *root, const char *key, combine_fn combine, void *ctx) {
+    Patrie *t = patrie_of(root);
+    TrieNode *path[PATRIE_PATH_MAX];
+    size_t depth;
+    TrieNode *n = insert_walk(t, key, path, &depth);
+    int created = !n->terminal;
+    Phenotype row = { .id = PHENO_NONE };
+    if (!created) pheno_load(t, n->pid, &row);
+    combine(&row, created, ctx);
+    agg_raise_insert(root, key, path, depth, row.score, (uint32_t)row.qual);
+    if (created) terminal_publish(t, n, key, pheno_new(t, row.score, row.qual, row.meta));
+    else { row_unshare(t, n, key); pheno_update(t, n->pid, row.score, row.qual, row.meta); }
+    return created;
+}
+
+static void agg_walk_visits(TrieNode *root, const char *key, uint64_t v) {
+    TrieNode *cur = root;
+    size_t i = 0;
+    for (;;) {
+        if (__atomic_load_n(&cur->max_visits, __ATOMIC_RELAXED) < v) __atomic_store_n(&cur->max_visits, v, __ATOMIC_RELAXED);
+        if (key[i] == '\0') return;
+        cur = *child_find(cur, (unsigned char)key[i]);
+        i += 1 + cur->plen;
+    }
+}
+
+// Ancestors always bound their descendants, so the climb stops at the first
+// node that already covers v. Nodes may be shared with snapshots, whose
+// readers load the bound, hence the relaxed atomics.
+static void agg_raise_visits(TrieNode *root, const char *key, TrieNode **path, size_t depth, uint64_t v) {
+    if (depth > PATRIE_PATH_MAX) { agg_walk_visits(root, key, v); return; }
+    while (depth-- > 0 && __atomic_load_n(&path[depth]->max_visits, __ATOMIC_RELAXED) < v)
+        __atomic_store_n(&path[depth]->max_visits, v, __ATOMIC_RELAXED);
+}
+
+// Answers from the hash index. The row's visits are bumped without walking
+// the path, so the subtrie bounds are brought up to date lazily (see
+// agg_fix_visits).
+static int lookup_hashed(Patrie *t, const char *key, Phenotype *out) {
+    const HashSlot *s = hidx_find(t->hidx, key, str_hash(key));
+    if (!s) return stat_lookup(t, 0, 0);
+    stat_lookup(t, 0, 1);
+    pheno_visit(t, s->id);
+    t->visits_stale = 1;
+    if (out) pheno_load(t, s->id, out);
+    return 1;
+}
+
+// Terminal node for key, or NULL; path[0..*depth) holds the nodes entered
+// (the first PATRIE_PATH_MAX of them).
+static TrieNode* lookup_node(Patrie *t, TrieNode *root, const char *key, TrieNode **path, size_t *depth) {
+    TrieNode *cur = root;
+    size_t i = 0, d = 0;
+    path[d++] = cur;
+    while (key[i] != '\0') {
+        TrieNode **slot = child_find(cur, (unsigned char)key[i]);
+        if (!slot) { stat_lookup(t, d, 0); return NULL; }
+        cur = *slot;
+        ++i;
+        if (prefix_match(cur->prefix, cur->plen, key + i) != cur->plen) { stat_lookup(t, d + 1, 0); return NULL; }
+        i += cur->plen;
+        if (d < PATRIE_PATH_MAX) path[d] = cur;
+        d++;
+    }
+    *depth = d;
+    return stat_lookup(t, d, cur->terminal) ? cur : NULL;
+}
+
+// Copies the phenotype into *out (which may be NULL) and bumps its visits
+// (not on a snapshot, which is read-only). Returns 1 if key is present.
+int patrie_lookup(TrieNode *root, const char *key, Phenotype *out) {
+    Patrie *t = patrie_of(root);
+    if (t->hidx) return lookup_hashed(t, key, out);
+    TrieNode *path[PATRIE_PATH_MAX];
+    size_t depth;
+    TrieNode *cur = lookup_node(t, root, key, path, &depth);
+    if (!cur) return 0;
+    if (!t->origin) agg_raise_visits(root, key, path, depth, pheno_visit(t, cur->pid));
+    if (out) pheno_load(t, cur->pid, out);
+    return 1;
+}
+
+// --------------------- Bulk load ---------------------
+typedef struct {
+    const char *key;
+    double score;
+    QualFlags qual;
+    const char *meta;
+} PatrieEntry;
+
+static NodeKind kind_for(size_t children) {
+    if (children == 0) return NODE_LEAF;
+    if (children <= 4) return NODE4;
+    if (children <= 16) return NODE16;
+    if (children <= 48) return NODE48;
+    return NODE256;
+}
+
+// Distinct non-terminating bytes at offset d across a sorted range.
+static size_t count_groups(const PatrieEntry *e, size_t lo, size_t hi, size_t d) {
+    size_t groups = 0;
+    int prev = -1;
+    for (size_t x = lo; x < hi; ++x) {
+        int b = (unsigned char)e[x].key[d];
+        if (b && b != prev) { ++groups; prev = b; }
+    }
+    return groups;
+}
+
+static TrieNode* build_node(Patrie *t, const PatrieEntry *e, size_t lo, size_t hi, size_t d);
+
+// Entries [lo, hi) share their first d bytes and n already has the kind that
+// fits their fan-out, so children are appended in order and nothing grows.
+static void build_fill(Patrie *t, TrieNode *n, const PatrieEntry *e, size_t lo, size_t hi, size_t d) {
+    size_t x = lo;
+    while (x < hi && e[x].key[d] == '\0') ++x;
+    if (x > lo) {
+        const PatrieEntry *last = &e[x - 1];   // duplicates: last one wins, as with repeated inserts
+        n->terminal = 1;
+        n->pid = pheno_new(t, last->score, last->qual, last->meta);
+        n->max_score = last->score;
+        n->qual_or = n->qual_and = (uint32_t)last->qual;
+    }
+    while (x < hi) {
+        unsigned char b = (unsigned char)e[x].key[d];
+        size_t y = x + 1;
+        while (y < hi && (unsigned char)e[y].key[d] == b) ++y;
+        TrieNode *ref = n, *c = build_node(t, e, x, y, d + 1);
+        agg_absorb(n, c);
+        child_add(t, &ref, b, c);
+        x = y;
+    }
+}
+
+static TrieNode* build_node(Patrie *t, const PatrieEntry *e, size_t lo, size_t hi, size_t d) {
+    const char *first = e[lo].key + d, *last = e[hi - 1].key + d;
+    size_t l = 0;
+    while (first[l] && first[l] == last[l]) ++l;   // LCP of a sorted range = LCP of its ends
+    TrieNode *n = trie_node_new(t, kind_for(count_groups(e, lo, hi, d + l)));
+    n->prefix = label_new(&t->arena, first, l);
+    n->plen = (uint32_t)l;
+    build_fill(t, n, e, lo, hi, d + l);
+    return n;
+}
+
+// Builds a trie from entries sorted by strcmp order in one pass: every node is
+// allocated once at its final size, in pre-order, straight from the arena.
+// Phenotype ids follow key order. Returns NULL if the input is not sorted.
+TrieNode* patrie_build_sorted(const PatrieEntry *entries, size_t n) {
+    size_t max_key = n ? strlen(entries[0].key) : 0;
+    for (size_t i = 1; i < n; ++i) {
+        if (strcmp(entries[i - 1].key, entries[i].key) > 0) return NULL;
+        size_t len = strlen(entries[i].key);
+        if (len > max_key) max_key = len;
+    }
+    TrieNode *root = patrie_new();
+    patrie_of(root)->max_key = max_key;
+    if (n) build_fill(patrie_of(root), root, entries, 0, n, 0);
+    return root;
+}
+
+// --------------------- Batched lookup ---------------------
+// Keeps PATRIE_BATCH_LANES keys in flight and advances each by one node per
+// round, prefetching the node it will touch next. By the time a lane comes
+// round again its node is usually in cache, so the misses of different keys
+// overlap instead of serialising.
+#define PATRIE_BATCH_LANES 16
+
+typedef struct {
+    const char *key;
+    size_t i;        // key bytes consumed before entering cur
+    TrieNode *cur;   // next node to enter (already prefetched)
+    size_t idx;
+    size_t depth;
+    TrieNode *path[PATRIE_PATH_MAX];
+} BatchLane;
+
+static void batch_lane_init(BatchLane *ln, TrieNode *root, const char *key, size_t idx) {
+    ln->key = key; ln->i = 0; ln->cur = root; ln->idx = idx; ln->depth = 0;
+}
+
+// Enters the lane's node; returns 1 once the lane has a result in *res.
+static int batch_step(BatchLane *ln, PhenoId *res) {
+    TrieNode *c = ln->cur;
+    const char *key = ln->key;
+    size_t i = ln->i;
+    if (prefix_match(c->prefix, c->plen, key + i) != c->plen) { *res = PHENO_NONE; return 1; }
+    i += c->plen;
+    if (ln->depth < PATRIE_PATH_MAX) ln->path[ln->depth] = c;
+    ln->depth++;
+    if (key[i] == '\0') { *res = c->terminal ? c->pid : PHENO_NONE; return 1; }
+    TrieNode **slot = child_find(c, (unsigned char)key[i]);
+    if (!slot) { *res = PHENO_NONE; return 1; }
+    ln->cur = *slot;
+    ln->i = i + 1;
+    __builtin_prefetch(ln->cur);
+    return 0;
+}
+
+// out[i] is the phenotype id for keys[i], or PHENO_NONE if absent; read rows
+// with patrie_pheno(). Visits and the subtrie aggregates are bumped as each
+// lane completes, while its path is still in cache.
+// Hashed form: keys are hashed PATRIE_BATCH_LANES ahead of their probe and
+// their groups prefetched, so the probes' cache misses overlap.
+static void lookup_batch_hashed(Patrie *t, const char *const *keys, size_t n, PhenoId *out) {
+    const HashIndex *hx = t->hidx;
+    uint64_t h[PATRIE_BATCH_LANES];
+    for (size_t i = 0; i < n + PATRIE_BATCH_LANES; ++i) {
+        uint64_t *hi = &h[i % PATRIE_BATCH_LANES];   // key i - LANES, then key i
+        if (i >= PATRIE_BATCH_LANES) {
+            size_t j = i - PATRIE_BATCH_LANES;
+            const HashSlot *s = hidx_find(hx, keys[j], *hi);
+            out[j] = s ? s->id : PHENO_NONE;
+            if (stat_lookup(t, 0, s != NULL)) pheno_visit(t, s->id);
+        }
+        if (i < n) {
+            *hi = str_hash(keys[i]);
+            size_t g = hidx_group(hx, *hi) * HIDX_GROUP;
+            __builtin_prefetch(hx->ctrl + g);
+            __builtin_prefetch(hx->slot + g);
+        }
+    }
+    if (n) t->visits_stale = 1;
+}
+
+void patrie_lookup_batch(TrieNode *root, const char *const *keys, size_t n, PhenoId *out) {
+    Patrie *t = patrie_of(root);
+    if (t->hidx) { lookup_batch_hashed(t, keys, n, out); return; }
+    BatchLane lane[PATRIE_BATCH_LANES];
+    size_t next = 0;
+    int active = 0;
+    while (active < PATRIE_BATCH_LANES && next < n) {
+        batch_lane_init(&lane[active], root, keys[next], next);
+        ++active; ++next;
+    }
+    while (active > 0) {
+        for (int l = 0; l < active; ) {
+            BatchLane *ln = &lane[l];
+            PhenoId res;
+            if (!batch_step(ln, &res)) { ++l; continue; }
+            out[ln->idx] = res;
+            if (stat_lookup(t, ln->depth, res != PHENO_NONE) && !t->origin) agg_raise_visits(root, ln->key, ln->path, ln->depth, pheno_visit(t, res));
+            if (next < n) {
+                batch_lane_init(ln, root, keys[next], next);
+                ++next; ++l;
+            } else lane[l] = lane[--active];
+        }
+    }
+}
+
+// --------------------- Snapshots ---------------------
+// patrie_snapshot() freezes the current version in O(1): the snapshot is a
+// copy of the trie header (root child array, phenotype directory), and a new
+// generation starts. Every node and row records the generation that wrote it,
+// and the writer never modifies anything a live snapshot can see: it copies
+// the root-to-node path it is about to change (path copying) and moves rows
+// to fresh ids. What the live trie stops using is retired with its birth
+// generation and recycled once no live snapshot can reach it.
+// Snapshots take the read-only calls (lookups there do not count visits;
+// visits counters stay shared with the live trie) and may be read from any
+// thread while the writer goes on. Release may happen on any thread too; the
+// writer frees the snapshot, and what only it was holding, on its next
+// reclamation pass.
+void patrie_reclaim(TrieNode *root) { epoch_reclaim(patrie_of(root)); }
+
+void patrie_snapshot_retain(TrieNode *snap) {
+    __atomic_add_fetch(&patrie_of(snap)->refs, 1, __ATOMIC_RELAXED);
+}
+
+void patrie_snapshot_release(TrieNode *snap) {
+    __atomic_sub_fetch(&patrie_of(snap)->refs, 1, __ATOMIC_RELEASE);
+}
+
+// Taken by the writer. A snapshot of a snapshot is the same snapshot.
+TrieNode* patrie_snapshot(TrieNode *root) {
+    Patrie *t = patrie_of(root);
+    if (t->origin) { patrie_snapshot_retain(root); return root; }
+    epoch_reclaim(t);
+    if (t->gen == UINT32_MAX) { fprintf(stderr, "patrie: snapshot generations exhausted\n"); exit(1); }
+    Patrie *s = aligned_alloc(64, (sizeof(Patrie) + 63) & ~(size_t)63);
+    if (!s) { perror("aligned_alloc"); exit(1); }
+    memcpy(s, t, offsetof(Patrie, readers));
+    memset(s->readers, 0, sizeof(s->readers));
+    memset(&s->arena, 0, sizeof(s->arena));   // a snapshot never allocates
+    s->concurrent = 0;
+    s->retired = NULL;
+    s->nretired = s->retired_cap = 0;
+    s->pheno.free_ids = NULL;
+    memset(&s->meta, 0, sizeof(s->meta));
+    s->qidx = NULL;
+    s->hidx = NULL;
+#ifdef PATRIE_STATS
+    memset(&s->stats, 0, sizeof(s->stats));
+#endif
+    s->visits_stale = t->visits_stale || t->hidx;   // hashed lookups go on bumping shared rows
+    s->origin = t;
+    s->refs = 1;
+    s->live = patrie_pheno_count(root);
+    s->snaps = t->snaps;
+    t->snaps = s;
+    t->snap_newest = t->gen++;
+    return &s->root.n;
+}
+
+// Drops released snapshots and recomputes the newest live generation.
+static void snap_sweep(Patrie *t) {
+    Patrie **pp = &t->snaps;
+    t->snap_newest = 0;
+    while (*pp) {
+        Patrie *s = *pp;
+        if (!__atomic_load_n(&s->refs, __ATOMIC_ACQUIRE)) { *pp = s->snaps; free(s); continue; }
+        if (s->gen > t->snap_newest) t->snap_newest = s->gen;
+        pp = &s->snaps;
+    }
+}
+
+// A block written at generation born and retired at gen is visible to the
+// snapshots taken in between.
+static int snap_holds(const Patrie *t, uint32_t born, uint32_t gen) {
+    for (const Patrie *s = t->snaps; s; s = s->snaps)
+        if (born <= s->gen && s->gen < gen) return 1;
+    return 0;
+}
+
+// --------------------- Concurrent readers ---------------------
+void patrie_enable_concurrent(TrieNode *root) { patrie_of(root)->concurrent = 1; }
+
+PatrieReader* patrie_reader_register(TrieNode *root) {
+    Patrie *t = patrie_of(root);
+    for (int i = 0; i < PATRIE_MAX_READERS; ++i) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&t->readers[i].in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return &t->readers[i];
+    }
+    return NULL;
+}
+
+void patrie_reader_unregister(PatrieReader *rd) {
+    __atomic_store_n(&rd->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rd->in_use, 0, __ATOMIC_RELEASE);
+}
+
+// Announces the current epoch; re-checked so a concurrent advance cannot slip
+// between reading the epoch and publishing it.
+void patrie_read_enter(TrieNode *root, PatrieReader *rd) {
+    Patrie *t = patrie_of(root);
+    if (rd->depth++) return;
+    uint64_t e;
+    do {
+        e = __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&rd->epoch, e, __ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST) != e);
+}
+
+void patrie_read_exit(PatrieReader *rd) {
+    if (--rd->depth == 0) __atomic_store_n(&rd->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// Advances the epoch when every active reader has caught up with it, then
+// recycles blocks retired at least two epochs ago that no snapshot holds.
+static void epoch_reclaim(Patrie *t) {
+    snap_sweep(t);
+    uint64_t e = __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST);
+    int advance = 1;
+    for (int i = 0; i < PATRIE_MAX_READERS && advance; ++i) {
+        uint64_t re = __atomic_load_n(&t->readers[i].epoch, __ATOMIC_SEQ_CST);
+        if (re && re != e) advance = 0;
+    }
+    if (advance) __atomic_store_n(&t->epoch, ++e, __ATOMIC_SEQ_CST);
+    size_t kept = 0;
+    for (size_t i = 0; i < t->nretired; ++i) {
+        Retired r = t->retired[i];
+        if ((t->concurrent && r.epoch + 2 > e) || snap_holds(t, r.born, r.gen)) t->retired[kept++] = r;
+        else if (r.p) arena_free(&t->arena, r.p, r.size);
+        else {
+            if (r.size) { pheno_zero(t, pheno_chunk(t, r.id), PHENO_SLOT(r.id)); t->pheno.held--; }
+            pheno_free_push(&t->pheno, r.id);
+        }
+    }
+    t->nretired = kept;
+}
+
+// Lock-free lookup for concurrent readers. The phenotype row is copied into
+// *out (visits included); the interned meta string stays valid for the
+// lifetime of the trie.
+// Concurrent counterpart of agg_raise_visits. A raise that races with the
+// writer copying the same node can be lost, so visits aggregates are
+// approximate while a writer is active.
+static void atomic_raise(uint64_t *p, uint64_t v) {
+    uint64_t cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (cur < v && !__atomic_compare_exchange_n(p, &cur, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+static void agg_raise_visits_shared(TrieNode *root, const char *key, TrieNode **path, size_t depth, uint64_t v) {
+    if (depth <= PATRIE_PATH_MAX) {
+        while (depth-- > 0 && __atomic_load_n(&path[depth]->max_visits, __ATOMIC_RELAXED) < v)
+            atomic_raise(&path[depth]->max_visits, v);
+        return;
+    }
+    TrieNode *cur = root;
+    size_t i = 0;
+    while (cur) {
+        atomic_raise(&cur->max_visits, v);
+        if (key[i] == '\0') return;
+        TrieNode **slot = child_find(cur, (unsigned char)key[i]);
+        cur = slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+        if (cur) i += 1 + cur->plen;
+    }
+}
+
+int patrie_lookup_shared(TrieNode *root, PatrieReader *rd, const char *key, Phenotype *out) {
+    patrie_read_enter(root, rd);
+    TrieNode *path[PATRIE_PATH_MAX];
+    size_t depth = 0;
+    TrieNode *cur = root;
+    size_t i = 0;
+    int found = 0;
+    path[depth++] = cur;
+    while (cur && key[i] != '\0') {
+        TrieNode **slot = child_find(cur, (unsigned char)key[i]);
+        cur = slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+        if (!cur) break;
+        ++i;
+        if (prefix_match(cur->prefix, cur->plen, key + i) != cur->plen) cur = NULL;
+        else i += cur->plen;
+        if (depth < PATRIE_PATH_MAX) path[depth] = cur;
+        depth++;
+    }
+    Patrie *t = patrie_of(root);
+    if (stat_lookup(t, depth, cur && __atomic_load_n(&cur->terminal, __ATOMIC_ACQUIRE))) {
+        PhenoId id = __atomic_load_n(&cur->pid, __ATOMIC_ACQUIRE);
+        uint64_t v = __atomic_add_fetch(&pheno_chunk(t, id)->visits[PHENO_SLOT(id)], 1, __ATOMIC_RELAXED);
+        agg_raise_visits_shared(root, key, path, depth, v);
+        pheno_load(t, id, out);
+        out->visits = v;
+        found = 1;
+    }
+    patrie_read_exit(rd);
+    return found;
+}
+
+// --------------------- Enumeration ---------------------
+// Callbacks receive a materialised copy of the row; it is valid only for the
+// duration of the call.
+typedef void (*token_cb)(const char *token, const Phenotype *p, void *ctx);
+
+// --------------------- Cursor ---------------------
+// Iterative in-order walk with an explicit stack. Every frame below the root
+// consumes at least one key byte, so the stack and key buffer are sized from
+// the longest key once at open and patrie_cursor_next() never allocates.
+// A cursor is invalidated by any write to the trie; reopen it from the last
+// key returned to resume.
+typedef struct {
+    TrieNode *node;
+    size_t keylen;   // key bytes up to and including this node's label
+    int pos;         // next child position: array index (NODE4/16) or key byte
+    int emit;        // node's own token not yet reported
+} CursorFrame;
+
+typedef struct {
+    const Patrie *t;
+    CursorFrame *stack;
+    size_t sp;
+    size_t floor;   // iteration ends once the stack unwinds below this frame
+    char *buf;
+    uint32_t require, exclude;   // qualifier filter; subtries that cannot match are skipped
+#ifdef PATRIE_STATS
+    uint64_t tokens, opened_ns;  // folded into the trie's stats on close
+#endif
+} PatrieCursor;
+
+static int qual_may_match(const TrieNode *n, uint32_t require, uint32_t exclude) {
+    return (n->qual_or & require) == require && !(n->qual_and & exclude);
+}
+
+static int qual_match(uint32_t qual, uint32_t require, uint32_t exclude) {
+    return (qual & require) == require && !(qual & exclude);
+}
+
+// Next child at or after *pos in key order, advancing *pos past it.
+static TrieNode* child_next(TrieNode *n, int *pos, unsigned char *key) {
+    switch (n->kind) {
+    case NODE4:
+    case NODE16: {
+        if (*pos >= n->count) return NULL;
+        int i = (*pos)++;
+        if (n->kind == NODE4) { *key = ((Node4 *)n)->keys[i]; return ((Node4 *)n)->child[i]; }
+        *key = ((Node16 *)n)->keys[i]; return ((Node16 *)n)->child[i];
+    }
+    case NODE48: {
+        Node48 *n48 = (Node48 *)n;
+        while (*pos < 256 && !n48->index[*pos]) ++*pos;
+        if (*pos >= 256) return NULL;
+        *key = (unsigned char)*pos;
+        return n48->child[n48->index[(*pos)++] - 1];
+    }
+    case NODE256: {
+        Node256 *n256 = (Node256 *)n;
+        while (*pos < 256 && !n256->child[*pos]) ++*pos;
+        if (*pos >= 256) return NULL;
+        *key = (unsigned char)*pos;
+        return n256->child[(*pos)++];
+    }
+    default:
+        return NULL;
+    }
+}
+
+// Position just past key b: first child > b is what remains to visit.
+static int child_pos_after(TrieNode *n, unsigned char b) {
+    if (n->kind == NODE4 || n->kind == NODE16) {
+        const unsigned char *keys = n->kind == NODE4 ? ((Node4 *)n)->keys : ((Node16 *)n)->keys;
+        int i = 0;
+        while (i < n->count && keys[i] <= b) ++i;
+        return i;
+    }
+    return b + 1;
+}
+
+static CursorFrame* cursor_push(PatrieCursor *c, TrieNode *n, unsigned char key, size_t at) {
+    c->buf[at] = (char)key;
+    if (n->plen) memcpy(c->buf + at + 1, n->prefix, n->plen);
+    CursorFrame *f = &c->stack[c->sp++];
+    *f = (CursorFrame){ n, at + 1 + n->plen, 0, 1 };
+    return f;
+}
+
+// Positions the stack on the first key >= from (> from unless inclusive).
+static void cursor_seek(PatrieCursor *c, const char *from, int inclusive) {
+    CursorFrame *f = &c->stack[0];
+    for (;;) {
+        size_t d = f->keylen;
+        if (from[d] == '\0') { f->emit = inclusive; return; }
+        f->emit = 0;   // this node's key is a proper prefix of from, so it sorts before
+        unsigned char b = (unsigned char)from[d];
+        TrieNode **slot = child_find(f->node, b);
+        f->pos = child_pos_after(f->node, b);
+        if (!slot) return;
+        TrieNode *n = *slot;
+        const unsigned char *rest = (const unsigned char *)from + d + 1;
+        uint32_t j = prefix_match(n->prefix, n->plen, from + d + 1);
+        if (j < n->plen) {
+            // label diverges from `from`: the subtree is entirely before or after it
+            if (rest[j] != '\0' && n->prefix[j] < rest[j]) return;
+            cursor_push(c, n, b, d);
+            return;
+        }
+        f = cursor_push(c, n, b, d);
+    }
+}
+
+PatrieCursor* patrie_cursor_open(TrieNode *root, const char *from, int inclusive) {
+    size_t depth = patrie_of(root)->max_key + 2;
+    PatrieCursor *c = malloc(sizeof(PatrieCursor));
+    if (!c) { perror("malloc"); exit(1); }
+    c->stack = malloc(depth * sizeof(CursorFrame));
+    c->buf = malloc(depth);
+    if (!c->stack || !c->buf) { perror("malloc"); exit(1); }
+    c->t = patrie_of(root);
+    c->stack[0] = (CursorFrame){ root, 0, 0, 1 };
+    c->sp = 1;
+    c->floor = 0;
+    c->require = c->exclude = 0;
+#ifdef PATRIE_STATS
+    c->tokens = 0;
+    c->opened_ns = stat_now_ns();
+#endif
+    if (from) cursor_seek(c, from, inclusive);
+    return c;
+}
+
+// Yields the next token in order and copies its row into *p (which may be
+// NULL); *token stays valid until the next call.
+int patrie_cursor_next(PatrieCursor *c, const char **token, Phenotype *p) {
+    while (c->sp > c->floor) {
+        CursorFrame *f = &c->stack[c->sp - 1];
+        if (f->emit) {
+            f->emit = 0;
+            TrieNode *n = f->node;
+            if (n->terminal && (!(c->require | c->exclude) || qual_match(pheno_qual(c->t, n->pid), c->require, c->exclude))) {
+                c->buf[f->keylen] = '\0';
+                *token = c->buf;
+                if (p) pheno_load(c->t, n->pid, p);
+#ifdef PATRIE_STATS
+                c->tokens++;
+#endif
+                return 1;
+            }
+        }
+        unsigned char key;
+        TrieNode *n = child_next(f->node, &f->pos, &key);
+        if (!n) { c->sp--; continue; }
+        if (!qual_may_match(n, c->require, c->exclude)) continue;
+        cursor_push(c, n, key, f->keylen);
+    }
+    return 0;
+}
+
+void patrie_cursor_close(PatrieCursor *c) {
+    if (!c) return;
+#ifdef PATRIE_STATS
+    Patrie *t = (Patrie *)c->t;
+    STAT_ADD(t->stats.enum_tokens, c->tokens);
+    STAT_ADD(t->stats.enum_ns, stat_now_ns() - c->opened_ns);
+#endif
+    free(c->stack);
+    free(c->buf);
+    free(c);
+}
+
+void patrie_enumerate(TrieNode *root, token_cb cb, void *ctx) {
+    PatrieCursor *c = patrie_cursor_open(root, NULL, 1);
+    const char *token;
+    Phenotype p;
+    while (patrie_cursor_next(c, &token, &p)) cb(token, &p, ctx);
+    patrie_cursor_close(c);
+}
+
+// --------------------- Scans ---------------------
+// Return non-zero from the callback to stop a scan early.
+typedef int (*scan_cb)(const char *token, const Phenotype *p, void *ctx);
+
+static size_t cursor_drain(PatrieCursor *c, const char *hi, scan_cb cb, void *ctx) {
+    const char *token;
+    Phenotype p;
+    size_t n = 0;
+    while (patrie_cursor_next(c, &token, &p)) {
+        if (hi && strcmp(token, hi) >= 0) break;
+        ++n;
+        if (cb(token, &p, ctx)) break;
+    }
+    patrie_cursor_close(c);
+    return n;
+}
+
+// Tokens starting with prefix, in order. The cursor seeks straight to the node
+// covering the prefix and is floored there, so the scan never leaves that
+// subtrie. Returns the number of tokens passed to cb.
+static PatrieCursor* cursor_open_prefix(TrieNode *root, const char *prefix) {
+    PatrieCursor *c = patrie_cursor_open(root, prefix, 1);
+    size_t plen = strlen(prefix);
+    size_t f = 0;
+    while (f < c->sp && c->stack[f].keylen < plen) ++f;
+    if (f == c->sp || memcmp(c->buf, prefix, plen) != 0) { patrie_cursor_close(c); return NULL; }
+    c->floor = f;
+    return c;
+}
+
+size_t patrie_prefix_scan(TrieNode *root, const char *prefix, scan_cb cb, void *ctx) {
+    PatrieCursor *c = cursor_open_prefix(root, prefix);
+    return c ? cursor_drain(c, NULL, cb, ctx) : 0;
+}
 
-typedef struct AVLChild {
-    char key;
-    struct TrieNode *child;
-    int height;
-    struct AVLChild *left;
-    struct AVLChild *right;
-} AVLChild;
+// Tokens in [lo, hi) in order; NULL leaves that end open.
+size_t patrie_range_scan(TrieNode *root, const char *lo, const char *hi, scan_cb cb, void *ctx) {
+    return cursor_drain(patrie_cursor_open(root, lo, 1), hi, cb, ctx);
+}
 
-// --------------------- Trie Node ---------------------
-typedef struct TrieNode {
-    int terminal;
-    Phenotype *p;
-    AVLChild *children;
-} TrieNode;
+// Tokens (optionally under prefix) carrying every flag in require and none in
+// exclude, in key order. Subtries are skipped when their OR summary lacks a
+// required flag or their AND summary holds an excluded one.
+size_t patrie_qual_scan(TrieNode *root, const char *prefix, QualFlags require, QualFlags exclude,
+                        scan_cb cb, void *ctx) {
+    PatrieCursor *c = cursor_open_prefix(root, prefix ? prefix : "");
+    if (!c) return 0;
+    c->require = (uint32_t)require;
+    c->exclude = (uint32_t)exclude;
+    return cursor_drain(c, NULL, cb, ctx);
+}
 
-// --------------------- Utility ---------------------
-static int max(int a, int b) { return (a > b) ? a : b; }
-static int height_avl(AVLChild *n) { return n ? n->height : 0; }
-static void update_height(AVLChild *n) { if (n) n->height = 1 + max(height_avl(n->left), height_avl(n->right)); }
-static int balance_factor(AVLChild *n) { return n ? height_avl(n->left) - height_avl(n->right) : 0; }
-static void avl_free(AVLChild *root);
-
-static AVLChild* rotate_right(AVLChild *y) {
-    AVLChild *x = y->left;
-    AVLChild *T2 = x->right;
-    x->right = y;
-    y->left = T2;
-    update_height(y); update_height(x);
-    return x;
-}
-
-static AVLChild* rotate_left(AVLChild *x) {
-    AVLChild *y = x->right;
-    AVLChild *T2 = y->left;
-    y->left = x;
-    x->right = T2;
-    update_height(x); update_height(y);
-    return y;
-}
-
-static AVLChild* avl_insert_child(AVLChild *root, char key, TrieNode *child) {
-    if (!root) {
-        AVLChild *n = malloc(sizeof(AVLChild));
-        if (!n) { perror("malloc"); exit(1); }
-        n->key = key; n->child = child; n->left = n->right = NULL; n->height = 1;
-        return n;
-    }
-    if (key < root->key) root->left = avl_insert_child(root->left, key, child);
-    else if (key > root->key) root->right = avl_insert_child(root->right, key, child);
-    else { root->child = child; return root; }
-
-    update_height(root);
-    int bf = balance_factor(root);
-    if (bf > 1 && key < root->left->key) return rotate_right(root);
-    if (bf < -1 && key > root->right->key) return rotate_left(root);
-    if (bf > 1 && key > root->left->key) { root->left = rotate_left(root->left); return rotate_right(root); }
-    if (bf < -1 && key < root->right->key) { root->right = rotate_right(root->right); return rotate_left(root); }
+// Builds the flag -> id bitmaps from the current contents; insert keeps them
+// in sync from then on.
+void patrie_qual_index_enable(TrieNode *root) {
+    Patrie *t = patrie_of(root);
+    if (t->qidx) return;
+    t->qidx = calloc(1, sizeof(QualIndex));
+    if (!t->qidx) { perror("calloc"); exit(1); }
+    PatrieCursor *c = patrie_cursor_open(root, NULL, 1);
+    const char *token;
+    Phenotype p;
+    while (patrie_cursor_next(c, &token, &p)) qidx_add(t, token, p.id, (uint32_t)p.qual);
+    patrie_cursor_close(c);
+}
 
-    return root;
+// Builds the key -> id hash index from the current contents; insert and delete
+// keep it in sync, and patrie_lookup / patrie_lookup_batch answer from it.
+// Lock-free readers and snapshots keep using the trie.
+void patrie_hash_index_enable(TrieNode *root) {
+    Patrie *t = patrie_of(root);
+    if (t->hidx || t->origin) return;
+    t->hidx = calloc(1, sizeof(HashIndex));
+    if (!t->hidx) { perror("calloc"); exit(1); }
+    hidx_rehash(t->hidx, 2 * patrie_pheno_count(root));
+    PatrieCursor *c = patrie_cursor_open(root, NULL, 1);
+    const char *token;
+    Phenotype p;
+    while (patrie_cursor_next(c, &token, &p)) hidx_put(t, token, p.id);
+    patrie_cursor_close(c);
 }
 
-static AVLChild* avl_find_child(AVLChild *root, char key) {
-    while (root) {
-        if (key == root->key) return root;
-        root = (key < root->key) ? root->left : root->right;
+// Flag query answered from the bitmap index in id (creation) order; without
+// an index it falls back to the pruned patrie_qual_scan. Work is per matching
+// container rather than per token in the trie.
+size_t patrie_qual_query(TrieNode *root, QualFlags require, QualFlags exclude, scan_cb cb, void *ctx) {
+    Patrie *t = patrie_of(root);
+    QualIndex *qi = t->qidx;
+    if (!qi) return patrie_qual_scan(root, NULL, require, exclude, cb, ctx);
+    // drive from the sparsest required set, or from all live ids
+    const RoarBitmap *drive = &qi->live;
+    uint64_t best = UINT64_MAX;
+    for (int bit = 0; bit < QUAL_BITS; ++bit)
+        if (((uint32_t)require & (1u << bit)) && roar_card(&qi->flag[bit]) < best) {
+            best = roar_card(&qi->flag[bit]);
+            drive = &qi->flag[bit];
+        }
+    uint64_t w[ROAR_WORDS], tmp[ROAR_WORDS];
+    size_t n = 0;
+    for (size_t ci = 0; ci < drive->n; ++ci) {
+        uint16_t hk = drive->c[ci].key;
+        roar_words(&drive->c[ci], w);
+        int empty = 0;
+        for (int bit = 0; bit < QUAL_BITS && !empty; ++bit) {
+            uint32_t m = 1u << bit;
+            if (!(((uint32_t)require | (uint32_t)exclude) & m) || drive == &qi->flag[bit]) continue;
+            const RoarContainer *oc = roar_find(&qi->flag[bit], hk);
+            if (!oc) { empty = ((uint32_t)require & m) != 0; continue; }
+            roar_words(oc, tmp);
+            if ((uint32_t)require & m) for (int k = 0; k < ROAR_WORDS; ++k) w[k] &= tmp[k];
+            else for (int k = 0; k < ROAR_WORDS; ++k) w[k] &= ~tmp[k];
+        }
+        if (empty) continue;
+        for (int k = 0; k < ROAR_WORDS; ++k)
+            for (uint64_t bits = w[k]; bits; bits &= bits - 1) {
+                uint32_t id = ((uint32_t)hk << 16) | (uint32_t)(k * 64 + __builtin_ctzll(bits));
+                Phenotype p;
+                pheno_load(t, id, &p);
+                ++n;
+                if (cb(qi->key[id], &p, ctx)) return n;
+            }
     }
-    return NULL;
+    return n;
 }
 
-typedef void (*child_visit_fn)(char key, TrieNode *child, void *ctx);
-static void avl_inorder(AVLChild *root, child_visit_fn fn, void *ctx) {
-    if (!root) return;
-    avl_inorder(root->left, fn, ctx);
-    fn(root->key, root->child, ctx);
-    avl_inorder(root->right, fn, ctx);
+// --------------------- Delete ---------------------
+// Deleting a token clears its terminal flag and frees its row. On the way back
+// up, nodes left with neither a token nor children are unlinked, and a node
+// left with no token and one child is merged into that child, so labels stay
+// maximally compressed. Child maps drop to a narrower kind once they fall well
+// below capacity (shrink_at), leaving room so that add/remove at a boundary
+// does not thrash. Every replaced node and label goes through retirement.
+static const uint16_t shrink_at[] = {
+    [NODE_LEAF] = 0, [NODE4] = 0, [NODE16] = 3, [NODE48] = 12, [NODE256] = 37,
+};
+
+// Copies old without child key into a node of the given (narrower) kind.
+static TrieNode* node_rebuild(Patrie *t, TrieNode *old, unsigned char skip, NodeKind kind) {
+    TrieNode *g = trie_node_new(t, kind);
+    int pos = 0, n = 0;
+    unsigned char key;
+    TrieNode *child;
+    while ((child = child_next(old, &pos, &key))) {
+        if (key == skip) continue;
+        switch (kind) {
+        case NODE4:  ((Node4 *)g)->keys[n] = key;  ((Node4 *)g)->child[n] = child;  break;
+        case NODE16: ((Node16 *)g)->keys[n] = key; ((Node16 *)g)->child[n] = child; break;
+        case NODE48: ((Node48 *)g)->index[key] = (uint8_t)(n + 1); ((Node48 *)g)->child[n] = child; break;
+        default: break;
+        }
+        ++n;
+    }
+    node_header_copy(g, old, kind);
+    g->count = (uint16_t)n;
+    return g;
 }
 
-// --------------------- Trie + Phenotype ---------------------
-static TrieNode* trie_node_new(void) {
-    TrieNode *n = malloc(sizeof(TrieNode));
-    if (!n) { perror("malloc"); exit(1); }
-    n->terminal = 0; n->p = NULL; n->children = NULL;
-    return n;
+// Removes the child under key from the node in *ref, shrinking or (for
+// concurrent readers) copying it as needed. The embedded root is edited in place.
+static void child_remove(Patrie *t, TrieNode **ref, unsigned char key) {
+    TrieNode *old = *ref, *n = old;
+    int is_root = old == &t->root.n;
+    if (!is_root && old->count - 1 <= shrink_at[old->kind]) {
+        n = node_rebuild(t, old, key, kind_for(old->count - 1u));
+        STAT_ADD(t->stats.node_shrinks, 1);
+    } else {
+        if (t->concurrent && old->kind <= NODE48) n = node_clone(t, old, (NodeKind)old->kind);
+        switch (n->kind) {
+        case NODE4:
+        case NODE16: {
+            unsigned char *keys = n->kind == NODE4 ? ((Node4 *)n)->keys : ((Node16 *)n)->keys;
+            TrieNode **kids = n->kind == NODE4 ? ((Node4 *)n)->child : ((Node16 *)n)->child;
+            int i = 0;
+            while (keys[i] != key) ++i;
+            for (; i + 1 < n->count; ++i) { keys[i] = keys[i + 1]; kids[i] = kids[i + 1]; }
+            break;
+        }
+        case NODE48: {
+            // fill the hole with the last slot so slots stay dense
+            Node48 *n48 = (Node48 *)n;
+            int hole = n48->index[key] - 1, last = n->count - 1;
+            if (hole != last)
+                for (int k = 0; k < 256; ++k)
+                    if (n48->index[k] == last + 1) {
+                        n48->child[hole] = n48->child[last];
+                        n48->index[k] = (uint8_t)(hole + 1);
+                        break;
+                    }
+            n48->index[key] = 0;
+            break;
+        }
+        default:
+            __atomic_store_n(&((Node256 *)n)->child[key], NULL, __ATOMIC_RELEASE);
+            break;
+        }
+        n->count--;
+    }
+    if (n != old) {
+        __atomic_store_n(ref, n, __ATOMIC_RELEASE);
+        node_retire(t, old);
+    }
 }
 
-static char *my_strdup(const char *s) {
-    if (!s) return NULL;
-    size_t len = strlen(s) + 1;
-    char *p = malloc(len);
-    if (p) memcpy(p, s, len);
-    return p;
+static void node_free(Patrie *t, TrieNode *n) {
+    label_free(t, n->prefix, n->plen, n->gen);
+    node_retire(t, n);
 }
 
-static Phenotype* phenotype_new(double score, QualFlags qual, const char *meta) {
-    Phenotype *p = malloc(sizeof(Phenotype));
-    if (!p) { perror("malloc"); exit(1); }
-    p->score = score; p->visits = 0; p->qual = qual;
-    p->meta = meta ? my_strdup(meta) : NULL;
-    return p;
+// Replaces x, which holds no token and exactly one child, by that child with
+// x's label, the key byte and the child's label joined into one.
+static void node_merge_child(Patrie *t, TrieNode **ref, TrieNode *x) {
+    int pos = 0;
+    unsigned char byte;
+    TrieNode *c = child_next(x, &pos, &byte);
+    size_t len = (size_t)x->plen + 1 + c->plen;
+    unsigned char *label = arena_alloc(&t->arena, len);
+    if (x->plen) memcpy(label, x->prefix, x->plen);
+    label[x->plen] = byte;
+    if (c->plen) memcpy(label + x->plen + 1, c->prefix, c->plen);
+    TrieNode *m = t->concurrent || gen_shared(t, c->gen) ? node_clone(t, c, (NodeKind)c->kind) : c;
+    const unsigned char *old = c->prefix;
+    uint32_t old_len = c->plen;
+    m->prefix = label;
+    m->plen = (uint32_t)len;
+    __atomic_store_n(ref, m, __ATOMIC_RELEASE);
+    label_free(t, old, old_len, c->gen);
+    if (m != c) node_retire(t, c);
+    node_free(t, x);
 }
 
-static void phenotype_free(Phenotype *p) {
-    if (!p) return;
-    free(p->meta);
-    free(p);
+// Removes key and its phenotype. Returns 1 if the key was present. Subtrie
+// aggregates stay upper bounds, as after an overwrite. In concurrent mode
+// readers may still return the row until their read section ends; snapshots
+// keep it for as long as they live.
+int patrie_delete(TrieNode *root, const char *key) {
+    Patrie *t = patrie_of(root);
+    size_t len = strlen(key);
+    // refs[d] is the slot holding the d-th node on the path, bytes[d] its key byte
+    TrieNode **ref_buf[PATRIE_PATH_MAX];
+    unsigned char byte_buf[PATRIE_PATH_MAX];
+    TrieNode ***refs = ref_buf;
+    unsigned char *bytes = byte_buf;
+    if (len + 1 > PATRIE_PATH_MAX) {
+        refs = malloc((len + 1) * sizeof(*refs));
+        bytes = malloc(len + 1);
+        if (!refs || !bytes) { perror("malloc"); exit(1); }
+    }
+    TrieNode *top = root, *cur = root;
+    size_t depth = 0, i = 0;
+    int found = 0;
+    refs[depth++] = &top;   // the root is edited in place, never replaced
+    while (key[i] != '\0') {
+        unsigned char ch = (unsigned char)key[i];
+        TrieNode **slot = child_find(cur, ch);
+        if (!slot) goto done;
+        cur = *slot;
+        ++i;
+        if (prefix_match(cur->prefix, cur->plen, key + i) != cur->plen) goto done;
+        i += cur->plen;
+        bytes[depth] = ch;
+        refs[depth++] = slot;
+    }
+    if (!cur->terminal) goto done;
+    found = 1;
+    if (t->hidx) hidx_remove(t, key);
+    // path copying: everything from the root down is made private to the writer
+    for (size_t d = 1; d < depth; ++d) {
+        refs[d] = child_find(*refs[d - 1], bytes[d]);
+        if (gen_shared(t, (*refs[d])->gen)) node_unshare(t, refs[d], *refs[d]);
+    }
+    cur = *refs[depth - 1];
+    __atomic_store_n(&cur->terminal, 0, __ATOMIC_RELEASE);
+    pheno_release(t, cur->pid);
+    for (size_t d = depth - 1; d > 0; --d) {
+        TrieNode *x = *refs[d];
+        if (x->terminal || x->count >= 2) break;
+        if (x->count == 1) { node_merge_child(t, refs[d], x); break; }
+        child_remove(t, refs[d - 1], bytes[d]);
+        node_free(t, x);
+    }
+done:
+    if (refs != ref_buf) { free(refs); free(bytes); }
+    return found;
 }
 
-void patrie_insert(TrieNode *root, const char *key, double score, QualFlags qual, const char *meta) {
+// Deletes every token scoring below threshold. Returns how many were removed.
+size_t patrie_prune(TrieNode *root, double threshold) {
+    size_t n = 0, used = 0, cap = 0, mcap = 0;
+    char *keys = NULL;
+    size_t *at = NULL;
+    PatrieCursor *c = patrie_cursor_open(root, NULL, 1);
+    const char *token;
+    Phenotype p;
+    while (patrie_cursor_next(c, &token, &p)) {
+        if (!(p.score < threshold)) continue;
+        size_t len = strlen(token) + 1;
+        if (used + len > cap) {
+            cap = (used + len) * 2;
+            keys = realloc(keys, cap);
+            if (!keys) { perror("realloc"); exit(1); }
+        }
+        if (n == mcap) {
+            mcap = mcap ? mcap * 2 : 64;
+            at = realloc(at, mcap * sizeof(size_t));
+            if (!at) { perror("realloc"); exit(1); }
+        }
+        memcpy(keys + used, token, len);
+        at[n++] = used;
+        used += len;
+    }
+    patrie_cursor_close(c);
+    for (size_t k = 0; k < n; ++k) patrie_delete(root, keys + at[k]);
+    free(keys);
+    free(at);
+    return n;
+}
+
+// --------------------- Top-K ---------------------
+typedef enum { PATRIE_BY_SCORE, PATRIE_BY_VISITS } PatrieRank;
+
+// Node whose subtrie holds exactly the keys starting with prefix, or NULL.
+// The node's own key is prefix[0..*at) followed by its full label.
+static TrieNode* prefix_node(TrieNode *root, const char *prefix, size_t *at) {
     TrieNode *cur = root;
-    for (size_t i = 0; key[i] != '\0'; ++i) {
-        char ch = key[i];
-        AVLChild *ac = avl_find_child(cur->children, ch);
-        if (!ac) {
-            TrieNode *newnode = trie_node_new();
-            cur->children = avl_insert_child(cur->children, ch, newnode);
-            ac = avl_find_child(cur->children, ch);
+    size_t i = 0;
+    *at = 0;
+    while (prefix[i] != '\0') {
+        TrieNode **slot = child_find(cur, (unsigned char)prefix[i]);
+        if (!slot) return NULL;
+        cur = *slot;
+        *at = ++i;
+        uint32_t j = prefix_match(cur->prefix, cur->plen, prefix + i);
+        if (j < cur->plen) return prefix[i + j] == '\0' ? cur : NULL;
+        i += cur->plen;
+    }
+    return cur;
+}
+
+// Heap entries are either a subtrie, ranked by its aggregate bound, or a single
+// token ranked by its exact value. Keys live in one growing pool.
+typedef struct {
+    double rank;
+    TrieNode *node;
+    int exact;
+    size_t key, len;   // offset/length in the key pool
+} TopkItem;
+
+typedef struct {
+    TopkItem *h;
+    size_t n, cap;
+    char *pool;
+    size_t used, pool_cap;
+} TopkHeap;
+
+// loose: the visits bounds cannot be trusted, so every subtrie must be opened.
+static double node_bound(const TrieNode *n, PatrieRank by, int loose) {
+    if (by == PATRIE_BY_SCORE) return n->max_score;
+    return loose ? INFINITY : (double)__atomic_load_n(&n->max_visits, __ATOMIC_RELAXED);
+}
+
+// Raises every max_visits bound to cover the rows below it, after hashed
+// lookups bumped visits without walking their paths. Nodes are listed
+// breadth-first and folded in reverse, so children come before parents.
+static void agg_fix_visits(Patrie *t) {
+    size_t cap = 1024, n = 0;
+    TrieNode **order = malloc(cap * sizeof(TrieNode *));
+    if (!order) { perror("malloc"); exit(1); }
+    order[n++] = &t->root.n;
+    for (size_t i = 0; i < n; ++i) {
+        int pos = 0;
+        unsigned char key;
+        TrieNode *child;
+        while ((child = child_next(order[i], &pos, &key))) {
+            if (n == cap) {
+                cap *= 2;
+                order = realloc(order, cap * sizeof(TrieNode *));
+                if (!order) { perror("realloc"); exit(1); }
+            }
+            order[n++] = child;
         }
-        cur = ac->child;
     }
-    cur->terminal = 1;
-    if (!cur->p) cur->p = phenotype_new(score, qual, meta);
-    else {
-        cur->p->score = score;
-        cur->p->qual = qual;
-        free(cur->p->meta);
-        cur->p->meta = meta ? my_strdup(meta) : NULL;
+    while (n--) {
+        TrieNode *x = order[n];
+        uint64_t v = x->terminal ? __atomic_load_n(&pheno_chunk(t, x->pid)->visits[PHENO_SLOT(x->pid)], __ATOMIC_RELAXED) : 0;
+        int pos = 0;
+        unsigned char key;
+        TrieNode *child;
+        while ((child = child_next(x, &pos, &key)))
+            if (__atomic_load_n(&child->max_visits, __ATOMIC_RELAXED) > v) v = child->max_visits;
+        if (v > x->max_visits) __atomic_store_n(&x->max_visits, v, __ATOMIC_RELAXED);
     }
+    free(order);
+    t->visits_stale = 0;
 }
 
-Phenotype* patrie_lookup(TrieNode *root, const char *key) {
-    TrieNode *cur = root;
-    for (size_t i = 0; key[i] != '\0'; ++i) {
-        AVLChild *ac = avl_find_child(cur->children, key[i]);
-        if (!ac) return NULL;
-        cur = ac->child;
+static double pheno_rank(const Patrie *t, PhenoId id, PatrieRank by) {
+    Phenotype p;
+    pheno_load(t, id, &p);
+    return by == PATRIE_BY_SCORE ? p.score : (double)p.visits;
+}
+
+static void topk_push(TopkHeap *hp, TopkItem it) {
+    if (hp->n == hp->cap) {
+        hp->cap = hp->cap ? hp->cap * 2 : 64;
+        hp->h = realloc(hp->h, hp->cap * sizeof(TopkItem));
+        if (!hp->h) { perror("realloc"); exit(1); }
     }
-    if (cur && cur->terminal) {
-        cur->p->visits++;
-        return cur->p;
+    size_t i = hp->n++;
+    while (i > 0 && hp->h[(i - 1) / 2].rank < it.rank) { hp->h[i] = hp->h[(i - 1) / 2]; i = (i - 1) / 2; }
+    hp->h[i] = it;
+}
+
+static TopkItem topk_pop(TopkHeap *hp) {
+    TopkItem top = hp->h[0], last = hp->h[--hp->n];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= hp->n) break;
+        if (c + 1 < hp->n && hp->h[c + 1].rank > hp->h[c].rank) ++c;
+        if (hp->h[c].rank <= last.rank) break;
+        hp->h[i] = hp->h[c]; i = c;
     }
-    return NULL;
+    if (hp->n) hp->h[i] = last;
+    return top;
 }
 
-// --------------------- Enumeration ---------------------
-typedef void (*token_cb)(const char *token, Phenotype *p, void *ctx);
+// Appends parent key + byte + label to the pool and returns its offset.
+static size_t topk_key(TopkHeap *hp, size_t parent, size_t plen, int byte, const TrieNode *n) {
+    size_t need = plen + (byte >= 0) + n->plen;
+    if (hp->used + need > hp->pool_cap) {
+        while (hp->used + need > hp->pool_cap) hp->pool_cap = hp->pool_cap ? hp->pool_cap * 2 : 256;
+        hp->pool = realloc(hp->pool, hp->pool_cap);
+        if (!hp->pool) { perror("realloc"); exit(1); }
+    }
+    size_t at = hp->used;
+    memmove(hp->pool + at, hp->pool + parent, plen);
+    if (byte >= 0) hp->pool[at + plen] = (char)byte;
+    if (n->plen) memcpy(hp->pool + at + plen + (byte >= 0), n->prefix, n->plen);
+    hp->used += need;
+    return at;
+}
 
 typedef struct {
-    char *buf;
-    size_t cap;
-    size_t len;
-    token_cb cb;
-    void *ctx;
-} EnumCtx;
+    TopkHeap *hp;
+    const TopkItem *parent;
+    PatrieRank by;
+    int loose;
+} TopkExpand;
+
+static void topk_child_fn(unsigned char key, TrieNode *child, void *ctx_) {
+    TopkExpand *x = ctx_;
+    size_t len = x->parent->len + 1 + child->plen;
+    size_t off = topk_key(x->hp, x->parent->key, x->parent->len, key, child);
+    topk_push(x->hp, (TopkItem){ node_bound(child, x->by, x->loose), child, 0, off, len });
+}
+
+// Best-first branch and bound: a token is reported only once it outranks the
+// bound of every subtrie still queued, so subtries whose aggregate falls below
+// the k-th result are never opened. Results arrive best first; returns how
+// many were reported (at most k). prefix may be NULL or "".
+size_t patrie_topk(TrieNode *root, const char *prefix, size_t k, PatrieRank by, token_cb cb, void *ctx) {
+    Patrie *t = patrie_of(root);
+    size_t at = 0;
+    TrieNode *start = prefix ? prefix_node(root, prefix, &at) : root;
+    if (!start || k == 0) return 0;
+    // A snapshot shares its rows, and so its visit counts, with the live trie,
+    // but nodes the live trie has since path-copied stop having their bounds
+    // raised. Its visits bounds are never trusted.
+    int loose = 0;
+    if (by == PATRIE_BY_VISITS) {
+        if (t->origin) loose = 1;
+        else if (t->visits_stale) agg_fix_visits(t);
+    }
+    TopkHeap hp = {0};
+    // seed the pool with the start node's key: the consumed prefix plus its label
+    hp.pool_cap = at + start->plen + 1;
+    hp.pool = malloc(hp.pool_cap);
+    if (!hp.pool) { perror("malloc"); exit(1); }
+    if (at) memcpy(hp.pool, prefix, at);
+    if (start->plen) memcpy(hp.pool + at, start->prefix, start->plen);
+    hp.used = at + start->plen;
+    topk_push(&hp, (TopkItem){ node_bound(start, by, loose), start, 0, 0, hp.used });
 
-static void ensure_buf(EnumCtx *ec, size_t need) {
-    if (ec->cap <= need) {
-        size_t nc = (ec->cap==0) ? 64 : ec->cap*2;
-        while (nc <= need) nc *= 2;
-        ec->buf = realloc(ec->buf, nc);
-        ec->cap = nc;
+    char *token = NULL;
+    size_t token_cap = 0, found = 0;
+    while (hp.n && found < k) {
+        TopkItem it = topk_pop(&hp);
+        if (it.exact) {
+            if (it.len + 1 > token_cap) {
+                token_cap = it.len + 1;
+                token = realloc(token, token_cap);
+                if (!token) { perror("realloc"); exit(1); }
+            }
+            memcpy(token, hp.pool + it.key, it.len);
+            token[it.len] = '\0';
+            Phenotype p;
+            pheno_load(t, it.node->pid, &p);
+            cb(token, &p, ctx);
+            ++found;
+            continue;
+        }
+        TrieNode *n = it.node;
+        if (n->terminal) topk_push(&hp, (TopkItem){ pheno_rank(t, n->pid, by), n, 1, it.key, it.len });
+        TopkExpand x = { &hp, &it, by, loose };
+        child_foreach(n, topk_child_fn, &x);
+    }
+    free(token);
+    free(hp.h);
+    free(hp.pool);
+    return found;
+}
+
+// --------------------- Aggregates ---------------------
+// Column kernels for dashboard statistics. Each works on one block of at most
+// PHENO_CHUNK contiguous values: a chunk of the columns directly, or values
+// gathered from a prefix's subtrie. The widest kernel set the CPU supports is
+// picked once at first use; results agree with the scalar set up to
+// floating-point summation order. Not safe against a concurrent writer.
+typedef struct {
+    double (*sum)(const double *x, size_t n);
+    double (*sqdev)(const double *x, size_t n, double mean);   // sum of (x - mean)^2
+    uint64_t (*sum_u64)(const uint64_t *x, size_t n);
+    uint32_t (*count_bit)(const uint32_t *q, size_t n, uint32_t bit);   // rows with q & bit
+    uint32_t (*or_all)(const uint32_t *q, size_t n);
+} AggKernels;
+
+static double agg_sum_scalar(const double *x, size_t n) {
+    double s = 0;
+    for (size_t i = 0; i < n; ++i) s += x[i];
+    return s;
+}
+
+static double agg_sqdev_scalar(const double *x, size_t n, double mean) {
+    double s = 0;
+    for (size_t i = 0; i < n; ++i) s += (x[i] - mean) * (x[i] - mean);
+    return s;
+}
+
+static uint64_t agg_sum_u64_scalar(const uint64_t *x, size_t n) {
+    uint64_t s = 0;
+    for (size_t i = 0; i < n; ++i) s += x[i];
+    return s;
+}
+
+static uint32_t agg_count_bit_scalar(const uint32_t *q, size_t n, uint32_t bit) {
+    uint32_t c = 0;
+    for (size_t i = 0; i < n; ++i) c += (q[i] & bit) != 0;
+    return c;
+}
+
+static uint32_t agg_or_scalar(const uint32_t *q, size_t n) {
+    uint32_t m = 0;
+    for (size_t i = 0; i < n; ++i) m |= q[i];
+    return m;
+}
+
+static const AggKernels agg_scalar = {
+    agg_sum_scalar, agg_sqdev_scalar, agg_sum_u64_scalar, agg_count_bit_scalar, agg_or_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AGG_AVX2 __attribute__((target("avx2,fma")))
+
+AGG_AVX2 static double agg_hsum256(__m256d v) {
+    __m128d lo = _mm256_castpd256_pd128(v), hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+AGG_AVX2 static uint64_t agg_hsum256_u64(__m256i v) {
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i *)lane, v);
+    return lane[0] + lane[1] + lane[2] + lane[3];
+}
+
+AGG_AVX2 static double agg_sum_avx2(const double *x, size_t n) {
+    __m256d a0 = _mm256_setzero_pd(), a1 = a0, a2 = a0, a3 = a0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        a0 = _mm256_add_pd(a0, _mm256_loadu_pd(x + i));
+        a1 = _mm256_add_pd(a1, _mm256_loadu_pd(x + i + 4));
+        a2 = _mm256_add_pd(a2, _mm256_loadu_pd(x + i + 8));
+        a3 = _mm256_add_pd(a3, _mm256_loadu_pd(x + i + 12));
     }
+    for (; i + 4 <= n; i += 4) a0 = _mm256_add_pd(a0, _mm256_loadu_pd(x + i));
+    double s = agg_hsum256(_mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3)));
+    return s + agg_sum_scalar(x + i, n - i);
 }
 
-static void trie_dfs(TrieNode *node, EnumCtx *ec);
+AGG_AVX2 static double agg_sqdev_avx2(const double *x, size_t n, double mean) {
+    __m256d m = _mm256_set1_pd(mean);
+    __m256d a0 = _mm256_setzero_pd(), a1 = a0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(x + i), m);
+        __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(x + i + 4), m);
+        a0 = _mm256_fmadd_pd(d0, d0, a0);
+        a1 = _mm256_fmadd_pd(d1, d1, a1);
+    }
+    double s = agg_hsum256(_mm256_add_pd(a0, a1));
+    return s + agg_sqdev_scalar(x + i, n - i, mean);
+}
 
-static void visit_tmp_fn(char key, TrieNode *child, void *ctx_) {
-    EnumCtx *e = (EnumCtx*)ctx_;
-    ensure_buf(e, e->len + 1);
-    e->buf[e->len++] = key;
-    trie_dfs(child, e);
-    e->len--;
+AGG_AVX2 static uint64_t agg_sum_u64_avx2(const uint64_t *x, size_t n) {
+    __m256i a0 = _mm256_setzero_si256(), a1 = a0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm256_add_epi64(a0, _mm256_loadu_si256((const __m256i *)(x + i)));
+        a1 = _mm256_add_epi64(a1, _mm256_loadu_si256((const __m256i *)(x + i + 4)));
+    }
+    return agg_hsum256_u64(_mm256_add_epi64(a0, a1)) + agg_sum_u64_scalar(x + i, n - i);
 }
 
-static void trie_dfs(TrieNode *node, EnumCtx *ec) {
-    if (!node) return;
-    if (node->terminal) {
-        ensure_buf(ec, ec->len + 1);
-        ec->buf[ec->len] = '\0';
-        ec->cb(ec->buf, node->p, ec->ctx);
+// A matching lane compares to all ones (-1), so subtracting counts it.
+AGG_AVX2 static uint32_t agg_count_bit_avx2(const uint32_t *q, size_t n, uint32_t bit) {
+    __m256i b = _mm256_set1_epi32((int)bit), acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(q + i)), b);
+        acc = _mm256_sub_epi32(acc, _mm256_cmpeq_epi32(v, b));
     }
-    avl_inorder(node->children, visit_tmp_fn, ec);
+    uint32_t lane[8];
+    _mm256_storeu_si256((__m256i *)lane, acc);
+    uint32_t c = 0;
+    for (int k = 0; k < 8; ++k) c += lane[k];
+    return c + agg_count_bit_scalar(q + i, n - i, bit);
 }
 
-void patrie_enumerate(TrieNode *root, token_cb cb, void *ctx) {
-    EnumCtx ec = { .buf = NULL, .cap = 0, .len = 0, .cb = cb, .ctx = ctx };
-    trie_dfs(root, &ec);
-    free(ec.buf);
+AGG_AVX2 static uint32_t agg_or_avx2(const uint32_t *q, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)(q + i)));
+    uint32_t lane[8];
+    _mm256_storeu_si256((__m256i *)lane, acc);
+    uint32_t m = 0;
+    for (int k = 0; k < 8; ++k) m |= lane[k];
+    return m | agg_or_scalar(q + i, n - i);
 }
 
-// --------------------- Free ---------------------
-static void visit_free_fn(char key, TrieNode *child, void *ctx_) {
-    (void)key; (void)ctx_;
-    if (child) {
-        // recurse into subtrie
-        TrieNode *c = child;
-        avl_inorder(c->children, visit_free_fn, NULL);
-        avl_free(c->children);
-        if (c->p) phenotype_free(c->p);
-        free(c);
+static const AggKernels agg_avx2 = {
+    agg_sum_avx2, agg_sqdev_avx2, agg_sum_u64_avx2, agg_count_bit_avx2, agg_or_avx2,
+};
+#elif defined(__aarch64__)
+static double agg_sum_neon(const double *x, size_t n) {
+    float64x2_t a0 = vdupq_n_f64(0), a1 = a0, a2 = a0, a3 = a0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a0 = vaddq_f64(a0, vld1q_f64(x + i));
+        a1 = vaddq_f64(a1, vld1q_f64(x + i + 2));
+        a2 = vaddq_f64(a2, vld1q_f64(x + i + 4));
+        a3 = vaddq_f64(a3, vld1q_f64(x + i + 6));
+    }
+    double s = vaddvq_f64(vaddq_f64(vaddq_f64(a0, a1), vaddq_f64(a2, a3)));
+    return s + agg_sum_scalar(x + i, n - i);
+}
+
+static double agg_sqdev_neon(const double *x, size_t n, double mean) {
+    float64x2_t m = vdupq_n_f64(mean), a0 = vdupq_n_f64(0), a1 = a0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float64x2_t d0 = vsubq_f64(vld1q_f64(x + i), m);
+        float64x2_t d1 = vsubq_f64(vld1q_f64(x + i + 2), m);
+        a0 = vfmaq_f64(a0, d0, d0);
+        a1 = vfmaq_f64(a1, d1, d1);
+    }
+    return vaddvq_f64(vaddq_f64(a0, a1)) + agg_sqdev_scalar(x + i, n - i, mean);
+}
+
+static uint64_t agg_sum_u64_neon(const uint64_t *x, size_t n) {
+    uint64x2_t a0 = vdupq_n_u64(0), a1 = a0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a0 = vaddq_u64(a0, vld1q_u64(x + i));
+        a1 = vaddq_u64(a1, vld1q_u64(x + i + 2));
+    }
+    return vaddvq_u64(vaddq_u64(a0, a1)) + agg_sum_u64_scalar(x + i, n - i);
+}
+
+static uint32_t agg_count_bit_neon(const uint32_t *q, size_t n, uint32_t bit) {
+    uint32x4_t b = vdupq_n_u32(bit), acc = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc = vsubq_u32(acc, vceqq_u32(vandq_u32(vld1q_u32(q + i), b), b));
+    return vaddvq_u32(acc) + agg_count_bit_scalar(q + i, n - i, bit);
+}
+
+static uint32_t agg_or_neon(const uint32_t *q, size_t n) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) acc = vorrq_u32(acc, vld1q_u32(q + i));
+    return vgetq_lane_u32(acc, 0) | vgetq_lane_u32(acc, 1) | vgetq_lane_u32(acc, 2) |
+           vgetq_lane_u32(acc, 3) | agg_or_scalar(q + i, n - i);
+}
+
+static const AggKernels agg_neon = {
+    agg_sum_neon, agg_sqdev_neon, agg_sum_u64_neon, agg_count_bit_neon, agg_or_neon,
+};
+#endif
+
+static const AggKernels* agg_kernels(void) {
+    static const AggKernels *chosen;
+    const AggKernels *k = __atomic_load_n(&chosen, __ATOMIC_RELAXED);
+    if (k) return k;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    k = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? &agg_avx2 : &agg_scalar;
+#elif defined(__aarch64__)
+    k = &agg_neon;
+#else
+    k = &agg_scalar;
+#endif
+    __atomic_store_n(&chosen, k, __ATOMIC_RELAXED);
+    return k;
+}
+
+typedef enum {
+    PATRIE_AGG_SCORE  = 1 << 0,   // mean and population variance of score
+    PATRIE_AGG_VISITS = 1 << 1,   // sum of visits
+    PATRIE_AGG_QUAL   = 1 << 2,   // per-flag row counts
+    PATRIE_AGG_ALL    = 7,
+} PatrieAggField;
+
+typedef struct {
+    size_t n;                        // rows aggregated
+    double score_mean, score_var;
+    uint64_t visits_sum;
+    uint64_t qual_hist[QUAL_BITS];   // qual_hist[b]: rows carrying flag 1 << b
+} PatrieAggregate;
+
+typedef struct {
+    const AggKernels *k;
+    unsigned what;
+    PatrieAggregate *out;
+    double m2;
+} AggState;
+
+// Folds one block in; block means and squared deviations are merged with the
+// parallel (Chan et al.) update so the variance stays accurate for long runs.
+// dead of the n rows are deleted ones: all their fields are zero, so they drop
+// out of the sums and each adds exactly mean^2 to the squared deviations.
+static void agg_block(AggState *st, const double *score, const uint64_t *visits, const uint32_t *qual,
+                      size_t n, size_t dead) {
+    PatrieAggregate *o = st->out;
+    size_t live = n - dead;
+    if (!live) return;
+    if (st->what & PATRIE_AGG_SCORE) {
+        double mean = st->k->sum(score, n) / (double)live;
+        double m2 = st->k->sqdev(score, n, mean) - (double)dead * mean * mean;
+        if (m2 < 0) m2 = 0;
+        double delta = mean - o->score_mean, tot = (double)(o->n + live);
+        o->score_mean += delta * (double)live / tot;
+        st->m2 += m2 + delta * delta * (double)o->n * (double)live / tot;
+    }
+    if (st->what & PATRIE_AGG_VISITS) o->visits_sum += st->k->sum_u64(visits, n);
+    if (st->what & PATRIE_AGG_QUAL)
+        for (uint32_t present = st->k->or_all(qual, n); present; present &= present - 1) {
+            int bit = __builtin_ctz(present);
+            o->qual_hist[bit] += st->k->count_bit(qual, n, 1u << bit);
+        }
+    o->n += live;
+}
+
+// Walks a subtrie and feeds its rows to agg_block in gathered blocks.
+static void agg_subtrie(const Patrie *t, TrieNode *start, AggState *st) {
+    static const size_t block = PHENO_CHUNK;
+    double *score = malloc(block * sizeof(double));
+    uint64_t *visits = malloc(block * sizeof(uint64_t));
+    uint32_t *qual = malloc(block * sizeof(uint32_t));
+    size_t cap = 64, sp = 0, n = 0;
+    TrieNode **stack = malloc(cap * sizeof(TrieNode *));
+    if (!score || !visits || !qual || !stack) { perror("malloc"); exit(1); }
+    stack[sp++] = start;
+    while (sp) {
+        TrieNode *node = stack[--sp];
+        if (node->terminal) {
+            PhenoChunk *c = pheno_chunk(t, node->pid);
+            uint32_t k = PHENO_SLOT(node->pid);
+            score[n] = c->score[k]; visits[n] = __atomic_load_n(&c->visits[k], __ATOMIC_RELAXED); qual[n] = c->qual[k];
+            if (++n == block) { agg_block(st, score, visits, qual, n, 0); n = 0; }
+        }
+        int pos = 0;
+        unsigned char key;
+        TrieNode *child;
+        while ((child = child_next(node, &pos, &key))) {
+            if (sp == cap) {
+                cap *= 2;
+                stack = realloc(stack, cap * sizeof(TrieNode *));
+                if (!stack) { perror("realloc"); exit(1); }
+            }
+            stack[sp++] = child;
+        }
+    }
+    agg_block(st, score, visits, qual, n, 0);
+    free(stack); free(score); free(visits); free(qual);
+}
+
+// Aggregates the fields selected by what over every token, or over tokens
+// starting with prefix. Without a prefix the kernels run straight over the
+// phenotype columns. Returns the number of rows aggregated (also out->n).
+size_t patrie_aggregate(TrieNode *root, const char *prefix, unsigned what, PatrieAggregate *out) {
+    Patrie *t = patrie_of(root);
+    AggState st = { agg_kernels(), what, out, 0 };
+    memset(out, 0, sizeof(*out));
+    if (prefix && *prefix) {
+        size_t at;
+        TrieNode *start = prefix_node(root, prefix, &at);
+        if (start) agg_subtrie(t, start, &st);
+    } else if (t->origin || t->pheno.held) {
+        agg_subtrie(t, root, &st);   // the columns also hold rows outside this version
+    } else {
+        const PhenoStore *ps = &t->pheno;
+        for (uint32_t c = 0; c < ps->nchunks; ++c) {
+            size_t rows = ps->count - (size_t)c * PHENO_CHUNK;
+            if (rows > PHENO_CHUNK) rows = PHENO_CHUNK;
+            agg_block(&st, ps->dir[c]->score, ps->dir[c]->visits, ps->dir[c]->qual, rows, ps->dir[c]->dead);
+        }
+    }
+    if (out->n) out->score_var = st.m2 / (double)out->n;
+    else out->score_mean = 0;
+    return out->n;
+}
+
+// --------------------- Parallel ingest ---------------------
+// Keys are partitioned by first byte. Each bucket whose root slot is still
+// empty is built as an independent subtrie in a private staging trie, so
+// builders share nothing; buckets that already exist under the root are
+// inserted sequentially by the calling thread meanwhile. The staged rows are
+// then copied into the shared columns at precomputed bases, node ids are
+// rebased, and each subtrie is stitched into the root slot. Entries keep their
+// relative order within a bucket, so repeated keys resolve last-writer-wins
+// exactly as with sequential patrie_insert.
+// Tasks are claimed largest first from a shared counter, which balances
+// independent tasks as well as work stealing would.
+#define PATRIE_PAR_MIN 4096   // below this the pool costs more than it saves
+
+typedef struct {
+    unsigned char byte;
+    size_t lo, hi;         // range of the partitioned index
+    Patrie *stage;
+    PhenoId base;
+    const char **xlat;     // stage meta slot -> interned string in the target
+} IngestTask;
+
+typedef struct {
+    Patrie *t;
+    const PatrieEntry *e;
+    const size_t *order;   // entry indices grouped by first byte, stable
+    IngestTask *task;
+    size_t ntask;
+    size_t next;
+    int phase;
+} IngestJob;
+
+static void ingest_build(IngestJob *job, IngestTask *tk) {
+    tk->stage = patrie_of(patrie_new_with(&job->t->arena.alloc));
+    for (size_t x = tk->lo; x < tk->hi; ++x) {
+        const PatrieEntry *en = &job->e[job->order[x]];
+        patrie_insert(&tk->stage->root.n, en->key, en->score, en->qual, en->meta);
+    }
+}
+
+static const char* ingest_meta(const IngestTask *tk, const char *m) {
+    if (!m) return NULL;
+    const InternPool *ip = &tk->stage->meta;
+    size_t j = intern_hdr(m)->hash & (ip->cap - 1);
+    while (ip->slot[j] != m) j = (j + 1) & (ip->cap - 1);
+    return tk->xlat[j];
+}
+
+// Copies staged rows to [base, base + count) and rebases the subtrie's ids.
+static void ingest_rebase(IngestJob *job, IngestTask *tk) {
+    Patrie *t = job->t, *st = tk->stage;
+    for (PhenoId j = 0; j < st->pheno.count; ++j) {
+        PhenoChunk *src = st->pheno.dir[j >> PHENO_CHUNK_SHIFT], *dst = t->pheno.dir[(tk->base + j) >> PHENO_CHUNK_SHIFT];
+        uint32_t a = PHENO_SLOT(j), b = PHENO_SLOT(tk->base + j);
+        dst->score[b] = src->score[a];
+        dst->visits[b] = src->visits[a];
+        dst->qual[b] = src->qual[a];
+        dst->gen[b] = t->gen;
+        dst->meta[b] = ingest_meta(tk, src->meta[a]);
+    }
+    size_t cap = 64, sp = 0;
+    TrieNode **stack = malloc(cap * sizeof(TrieNode *));
+    if (!stack) { perror("malloc"); exit(1); }
+    stack[sp++] = st->root.child[tk->byte];
+    while (sp) {
+        TrieNode *n = stack[--sp];
+        if (n->terminal) n->pid += tk->base;
+        n->gen = t->gen;
+        int pos = 0;
+        unsigned char key;
+        TrieNode *child;
+        while ((child = child_next(n, &pos, &key))) {
+            if (sp == cap) {
+                cap *= 2;
+                stack = realloc(stack, cap * sizeof(TrieNode *));
+                if (!stack) { perror("realloc"); exit(1); }
+            }
+            stack[sp++] = child;
+        }
+    }
+    free(stack);
+}
+
+static void* ingest_worker(void *arg) {
+    IngestJob *job = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->ntask) return NULL;
+        if (job->phase == 0) ingest_build(job, &job->task[i]);
+        else ingest_rebase(job, &job->task[i]);
+    }
+}
+
+// Runs one phase on nthreads - 1 helpers plus the caller; between is executed
+// by the caller before it joins in.
+static void ingest_phase(IngestJob *job, int phase, int nthreads, const size_t *between, size_t nbetween) {
+    pthread_t tid[64];
+    int spawned = 0;
+    job->phase = phase;
+    job->next = 0;
+    for (int k = 1; k < nthreads && k < 64; ++k)
+        if (pthread_create(&tid[spawned], NULL, ingest_worker, job) == 0) ++spawned;
+    for (size_t x = 0; x < nbetween; ++x) {
+        const PatrieEntry *en = &job->e[between[x]];
+        patrie_insert(&job->t->root.n, en->key, en->score, en->qual, en->meta);
+    }
+    ingest_worker(job);
+    for (int k = 0; k < spawned; ++k) pthread_join(tid[k], NULL);
+}
+
+// Moves a staging arena's chunks and free blocks into the target arena.
+static void arena_adopt(Arena *a, Arena *from) {
+    ArenaChunk *c = from->head;
+    while (c) {
+        ArenaChunk *next = c->next;
+        if (a->head) { c->next = a->head->next; a->head->next = c; }   // keep the head serving bumps
+        else { c->next = NULL; a->head = c; }
+        c = next;
+    }
+#ifdef PATRIE_STATS
+    a->allocs += from->allocs; a->alloc_bytes += from->alloc_bytes;
+    a->chunks += from->chunks; a->chunk_bytes += from->chunk_bytes;
+#endif
+    for (size_t k = 0; k < sizeof(a->slab) / sizeof(a->slab[0]); ++k) {
+        void **blk = from->slab[k];
+        if (!blk) continue;
+        while (*blk) blk = *blk;
+        *blk = a->slab[k];
+        a->slab[k] = from->slab[k];
+    }
+    from->head = NULL;
+    memset(from->slab, 0, sizeof(from->slab));
+}
+
+static int ingest_cmp(const void *x, const void *y) {
+    const IngestTask *a = x, *b = y;
+    size_t na = a->hi - a->lo, nb = b->hi - b->lo;
+    return (na < nb) - (na > nb);
+}
+
+// Inserts entries in order with the same result as calling patrie_insert on
+// each, building disjoint first-byte subtries on nthreads threads (0 = one per
+// online CPU). Must not race with other writers; registered concurrent readers
+// keep working, as each subtrie is published only once complete. A custom
+// PatrieAllocator must be thread-safe.
+void patrie_insert_parallel(TrieNode *root, const PatrieEntry *entries, size_t n, int nthreads) {
+    Patrie *t = patrie_of(root);
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > 64) nthreads = 64;
+    if (nthreads <= 1 || n < PATRIE_PAR_MIN) {
+        for (size_t i = 0; i < n; ++i) patrie_insert(root, entries[i].key, entries[i].score, entries[i].qual, entries[i].meta);
+        return;
+    }
+    // stable counting sort on the first byte; bucket 0 holds empty keys
+    size_t start[257] = {0};
+    for (size_t i = 0; i < n; ++i) start[(unsigned char)entries[i].key[0] + 1]++;
+    for (int b = 0; b < 256; ++b) start[b + 1] += start[b];
+    size_t *order = malloc(n * sizeof(size_t)), fill[256];
+    IngestTask *task = malloc(256 * sizeof(IngestTask));
+    if (!order || !task) { perror("malloc"); exit(1); }
+    memcpy(fill, start, sizeof(fill));
+    for (size_t i = 0; i < n; ++i) order[fill[(unsigned char)entries[i].key[0]]++] = i;
+
+    // buckets with an existing subtrie (and empty keys) go sequentially, in order
+    size_t *serial = malloc(n * sizeof(size_t)), nserial = 0, ntask = 0;
+    if (!serial) { perror("malloc"); exit(1); }
+    for (int b = 0; b < 256; ++b) {
+        if (start[b] == start[b + 1]) continue;
+        if (b == 0 || t->root.child[b]) {
+            memcpy(serial + nserial, order + start[b], (start[b + 1] - start[b]) * sizeof(size_t));
+            nserial += start[b + 1] - start[b];
+        } else task[ntask++] = (IngestTask){ .byte = (unsigned char)b, .lo = start[b], .hi = start[b + 1] };
+    }
+    qsort(task, ntask, sizeof(IngestTask), ingest_cmp);
+    IngestJob job = { .t = t, .e = entries, .order = order, .task = task, .ntask = ntask };
+    ingest_phase(&job, 0, nthreads, serial, nserial);
+
+    // place every staged row and resolve its meta against the shared pool
+    size_t rows = 0;
+    for (size_t i = 0; i < ntask; ++i) {
+        IngestTask *tk = &task[i];
+        InternPool *ip = &tk->stage->meta;
+        tk->base = (PhenoId)(t->pheno.count + rows);
+        rows += tk->stage->pheno.count;
+        tk->xlat = malloc((ip->cap ? ip->cap : 1) * sizeof(const char *));
+        if (!tk->xlat) { perror("malloc"); exit(1); }
+        for (size_t j = 0; j < ip->cap; ++j)
+            tk->xlat[j] = ip->slot[j] ? intern_n(t, ip->slot[j], intern_hdr(ip->slot[j])->refs) : NULL;
+    }
+    pheno_reserve(t, rows);
+    ingest_phase(&job, 1, nthreads, NULL, 0);
+    t->pheno.count += (uint32_t)rows;
+
+    for (size_t i = 0; i < ntask; ++i) {
+        IngestTask *tk = &task[i];
+        Patrie *st = tk->stage;
+        TrieNode *sub = st->root.child[tk->byte];
+        agg_absorb(root, sub);
+        if (st->max_key > t->max_key) t->max_key = st->max_key;
+        arena_adopt(&t->arena, &st->arena);
+        stats_absorb(t, st);
+        for (size_t j = 0; j < st->meta.cap; ++j)   // staged copies are dead once translated
+            if (st->meta.slot[j]) arena_free(&t->arena, intern_hdr(st->meta.slot[j]), sizeof(InternStr) + strlen(st->meta.slot[j]) + 1);
+        __atomic_store_n(&t->root.child[tk->byte], sub, __ATOMIC_RELEASE);
+        t->root.n.count++;
+        if (t->qidx || t->hidx) {
+            char prefix[2] = { (char)tk->byte, '\0' };
+            PatrieCursor *c = cursor_open_prefix(root, prefix);
+            const char *token;
+            Phenotype p;
+            while (c && patrie_cursor_next(c, &token, &p)) {
+                if (t->qidx) qidx_add(t, token, p.id, (uint32_t)p.qual);
+                if (t->hidx) hidx_put(t, token, p.id);
+            }
+            patrie_cursor_close(c);
+        }
+        free(tk->xlat);
+        free(st->meta.slot);
+        free(st->pheno.free_ids);
+        free(st->retired);
+        free(st);
+    }
+    free(serial);
+    free(task);
+    free(order);
+}
+
+// --------------------- Snapshot image ---------------------
+// Pointer-free on-disk form of a trie. Every reference is a byte offset from
+// the start of the file, so the image is queried straight from a read-only
+// mapping and can be shared by any number of processes through the page cache.
+// Nodes are written in post-order (children first, root last):
+//   ImgNode, then for IMG_SPARSE  keys[count] padded to 8, child[count]
+//                     IMG_DENSE   index[256] (slot+1, 0 = none), child[count]
+// Labels, meta strings and ImgPheno records precede the node that uses them.
+// Images are native-endian and assumed to come from a trusted writer.
+#define PATRIE_IMG_MAGIC   "PLPTRIE1"
+#define PATRIE_IMG_VERSION 1u
+#define PATRIE_IMG_ENDIAN  0x01020304u
+
+enum { IMG_SPARSE, IMG_DENSE };
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t root;     // offset of the root node
+    uint64_t nodes;
+    uint64_t tokens;
+    uint64_t size;     // total file size
+} ImgHeader;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t terminal;
+    uint16_t count;
+    uint32_t plen;
+    uint64_t prefix;   // offset of the label bytes
+    uint64_t pheno;    // offset of the ImgPheno, 0 when not terminal
+} ImgNode;
+
+typedef struct {
+    double score;
+    uint64_t visits;
+    uint32_t qual;
+    uint32_t reserved;
+    uint64_t meta;     // offset of the NUL-terminated meta string, 0 = NULL
+} ImgPheno;
+
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    uint64_t root;
+} PatrieImage;
+
+typedef struct {
+    const Patrie *t;
+    FILE *f;
+    uint64_t off;
+    uint64_t nodes, tokens;
+    int err;
+    unsigned char *keys;   // child keys and offsets of every open node, stacked
+    uint64_t *offs;
+    size_t npend, pcap;
+} SnapWriter;
+
+static uint64_t snap_put(SnapWriter *w, const void *data, size_t len) {
+    uint64_t at = w->off;
+    if (len && fwrite(data, 1, len, w->f) != len) w->err = 1;
+    w->off += len;
+    return at;
+}
+
+static void snap_align(SnapWriter *w) {
+    static const uint8_t zeros[8];
+    snap_put(w, zeros, (8 - (w->off & 7)) & 7);
+}
+
+// Writes one node whose children, in key order, are already in the image.
+static uint64_t snap_write_node(SnapWriter *w, TrieNode *n, const unsigned char *keys,
+                                const uint64_t *offs, size_t count) {
+    ImgNode in = { .kind = count > 16 ? IMG_DENSE : IMG_SPARSE, .terminal = n->terminal,
+                   .count = (uint16_t)count, .plen = n->plen };
+    in.prefix = snap_put(w, n->prefix, n->plen);
+    if (n->terminal) {
+        Phenotype p;
+        pheno_load(w->t, n->pid, &p);
+        ImgPheno ip = { .score = p.score, .visits = p.visits, .qual = (uint32_t)p.qual };
+        if (p.meta) ip.meta = snap_put(w, p.meta, strlen(p.meta) + 1);
+        snap_align(w);
+        in.pheno = snap_put(w, &ip, sizeof(ip));
+        w->tokens++;
+    }
+    snap_align(w);
+    uint64_t at = snap_put(w, &in, sizeof(in));
+    if (in.kind == IMG_DENSE) {
+        uint8_t index[256] = {0};
+        for (size_t i = 0; i < count; ++i) index[keys[i]] = (uint8_t)(i + 1);
+        snap_put(w, index, sizeof(index));
+    } else {
+        snap_put(w, keys, count);
+        snap_align(w);
+    }
+    snap_put(w, offs, count * sizeof(uint64_t));
+    w->nodes++;
+    return at;
+}
+
+typedef struct {
+    TrieNode *node;
+    int pos;       // child_next() position
+    size_t base;   // first of this node's entries in w->keys / w->offs
+} SnapFrame;
+
+// Post-order walk with the cursor's explicit stack. Descending into a child
+// reserves its key/offset entry in the parent's run; the child fills in the
+// offset once written, and its own entries are popped with it.
+static uint64_t snap_write_tree(SnapWriter *w, TrieNode *root) {
+    SnapFrame *stack = malloc((w->t->max_key + 2) * sizeof(SnapFrame));
+    if (!stack) { perror("malloc"); exit(1); }
+    stack[0] = (SnapFrame){ root, 0, 0 };
+    size_t sp = 1;
+    uint64_t at = 0;
+    while (sp) {
+        SnapFrame *f = &stack[sp - 1];
+        unsigned char key;
+        TrieNode *child = child_next(f->node, &f->pos, &key);
+        if (child) {
+            if (w->npend == w->pcap) {
+                w->pcap = w->pcap ? w->pcap * 2 : 256;
+                w->keys = realloc(w->keys, w->pcap);
+                w->offs = realloc(w->offs, w->pcap * sizeof(uint64_t));
+                if (!w->keys || !w->offs) { perror("realloc"); exit(1); }
+            }
+            w->keys[w->npend++] = key;
+            stack[sp++] = (SnapFrame){ child, 0, w->npend };
+            continue;
+        }
+        at = snap_write_node(w, f->node, w->keys + f->base, w->offs + f->base, w->npend - f->base);
+        w->npend = f->base;
+        if (--sp) w->offs[f->base - 1] = at;
+    }
+    free(stack);
+    free(w->keys); free(w->offs);
+    return at;
+}
+
+// Writes the trie as a mappable image. Returns 0 on success, -1 with errno set.
+int patrie_save(TrieNode *root, const char *path) {
+    SnapWriter w = { .t = patrie_of(root), .f = fopen(path, "wb") };
+    if (!w.f) return -1;
+    ImgHeader h = { .version = PATRIE_IMG_VERSION, .endian = PATRIE_IMG_ENDIAN };
+    memcpy(h.magic, PATRIE_IMG_MAGIC, sizeof(h.magic));
+    snap_put(&w, &h, sizeof(h));
+    h.root = snap_write_tree(&w, root);
+    h.nodes = w.nodes; h.tokens = w.tokens; h.size = w.off;
+    if (fseek(w.f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, w.f) != 1) w.err = 1;
+    if (fclose(w.f) != 0) w.err = 1;
+    return w.err ? -1 : 0;
+}
+
+PatrieImage* patrie_image_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ImgHeader)) { close(fd); return NULL; }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+    const ImgHeader *h = base;
+    if (memcmp(h->magic, PATRIE_IMG_MAGIC, sizeof(h->magic)) != 0 || h->version != PATRIE_IMG_VERSION ||
+        h->endian != PATRIE_IMG_ENDIAN || h->size != (uint64_t)st.st_size ||
+        h->root < sizeof(ImgHeader) || h->root + sizeof(ImgNode) > h->size) {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    PatrieImage *img = malloc(sizeof(PatrieImage));
+    if (!img) { perror("malloc"); exit(1); }
+    img->base = base; img->size = (size_t)st.st_size; img->root = h->root;
+    return img;
+}
+
+void patrie_image_close(PatrieImage *img) {
+    if (!img) return;
+    munmap((void *)img->base, img->size);
+    free(img);
+}
+
+static const ImgNode* img_node(const PatrieImage *img, uint64_t off) { return (const ImgNode *)(img->base + off); }
+
+static const uint64_t* img_children(const ImgNode *n) {
+    const uint8_t *p = (const uint8_t *)(n + 1);
+    return (const uint64_t *)(n->kind == IMG_DENSE ? p + 256 : p + ((n->count + 7u) & ~7u));
+}
+
+static const ImgNode* img_child(const PatrieImage *img, const ImgNode *n, unsigned char key) {
+    const uint8_t *keys = (const uint8_t *)(n + 1);
+    if (n->kind == IMG_DENSE)
+        return keys[key] ? img_node(img, img_children(n)[keys[key] - 1]) : NULL;
+    for (unsigned i = 0; i < n->count; ++i)
+        if (keys[i] == key) return img_node(img, img_children(n)[i]);
+    return NULL;
+}
+
+static void img_pheno(const PatrieImage *img, const ImgNode *n, Phenotype *out) {
+    const ImgPheno *ip = (const ImgPheno *)(img->base + n->pheno);
+    out->score = ip->score;
+    out->visits = ip->visits;
+    out->qual = (QualFlags)ip->qual;
+    out->id = PHENO_NONE;   // images carry no row ids
+    out->meta = ip->meta ? (const char *)(img->base + ip->meta) : NULL;
+}
+
+// Same matching as patrie_lookup. The image is read-only, so visits are
+// reported as saved and not incremented; out->meta points into the mapping.
+int patrie_image_lookup(const PatrieImage *img, const char *key, Phenotype *out) {
+    const ImgNode *cur = img_node(img, img->root);
+    size_t i = 0;
+    while (key[i] != '\0') {
+        cur = img_child(img, cur, (unsigned char)key[i]);
+        if (!cur) return 0;
+        ++i;
+        if (prefix_match(img->base + cur->prefix, cur->plen, key + i) != cur->plen) return 0;
+        i += cur->plen;
+    }
+    if (!cur->terminal) return 0;
+    img_pheno(img, cur, out);
+    return 1;
+}
+
+typedef struct {
+    const ImgNode *node;
+    size_t keylen;   // key bytes up to and including this node's label
+    unsigned k;      // next key byte (dense) or array index (sparse)
+    unsigned seen;   // children visited so far
+} ImgFrame;
+
+// In-order enumeration straight off the mapping, with the cursor's explicit
+// stack; *p is a temporary view. Images do not record the longest key, so the
+// stack and key buffer grow as the walk goes deeper.
+void patrie_image_enumerate(const PatrieImage *img, token_cb cb, void *ctx) {
+    size_t cap = 64, sp = 1, bcap = 64;
+    ImgFrame *stack = malloc(cap * sizeof(ImgFrame));
+    char *buf = malloc(bcap);
+    if (!stack || !buf) { perror("malloc"); exit(1); }
+    stack[0] = (ImgFrame){ img_node(img, img->root), 0, 0, 0 };
+    const ImgNode *emit = stack[0].node;
+    while (sp) {
+        ImgFrame *f = &stack[sp - 1];
+        if (emit) {
+            if (emit->terminal) {
+                Phenotype p;
+                img_pheno(img, emit, &p);
+                buf[f->keylen] = '\0';
+                cb(buf, &p, ctx);
+            }
+            emit = NULL;
+        }
+        const ImgNode *n = f->node;
+        if (f->seen == n->count) { sp--; continue; }
+        const uint8_t *keys = (const uint8_t *)(n + 1);
+        unsigned idx, key;
+        if (n->kind == IMG_DENSE) {
+            while (!keys[f->k]) f->k++;
+            idx = keys[f->k] - 1u; key = f->k;
+        } else {
+            idx = f->k; key = keys[f->k];
+        }
+        f->k++; f->seen++;
+        const ImgNode *c = img_node(img, img_children(n)[idx]);
+        size_t at = f->keylen, len = at + 1 + c->plen;
+        if (len >= bcap) {
+            while (len >= bcap) bcap *= 2;
+            buf = realloc(buf, bcap);
+            if (!buf) { perror("realloc"); exit(1); }
+        }
+        if (sp == cap) {
+            cap *= 2;
+            stack = realloc(stack, cap * sizeof(ImgFrame));
+            if (!stack) { perror("realloc"); exit(1); }
+        }
+        buf[at] = (char)key;
+        memcpy(buf + at + 1, img->base + c->prefix, c->plen);
+        stack[sp++] = (ImgFrame){ c, len, 0, 0 };
+        emit = c;
+    }
+    free(stack);
+    free(buf);
+}
+
+// --------------------- Export ---------------------
+// Streams every token, in key order, to a plp_sink (see common/plp_sink.h) as
+// phenotype rows. Returns the number of rows written; check plp_sink_close()
+// for I/O errors.
+size_t patrie_export(TrieNode *root, PlpSink *sink) {
+    PatrieCursor *c = patrie_cursor_open(root, NULL, 1);
+    const char *token;
+    Phenotype p;
+    size_t n = 0;
+    while (patrie_cursor_next(c, &token, &p)) {
+        plp_sink_pheno(sink, token, p.score, p.visits, (uint32_t)p.qual, p.id, p.meta);
+        ++n;
     }
+    patrie_cursor_close(c);
+    return n;
 }
 
-static void avl_free(AVLChild *root) {
+// --------------------- Free ---------------------
+// Nodes never own memory individually: dropping the arena releases the whole
+// trie. Snapshots still outstanding die with it.
+static void trie_free(TrieNode *root) {
     if (!root) return;
-    avl_free(root->left);
-    avl_free(root->right);
-    free(root);
+    Patrie *t = patrie_of(root);
+    while (t->snaps) { Patrie *s = t->snaps; t->snaps = s->snaps; free(s); }
+    arena_release(&t->arena);
+    qidx_free(t->qidx);
+    hidx_free(t->hidx);
+    free(t->meta.slot);
+    free(t->pheno.free_ids);
+    free(t->retired);
+    free(t);
+}
+
+// --------------------- Record ABI ---------------------
+// Fixed-layout binary rows for callers in other languages (src/record.rs is
+// the Rust side). A record is a PatrieRecord header followed by the key, a
+// NUL, the meta string (unless meta_len is PATRIE_RECORD_NO_META), a NUL and
+// zero padding to a multiple of 8; size covers all of it, so records can be
+// packed back to back in one buffer. Keys and meta are used in place: insert
+// copies them straight into the arena, and lookup writes a record into the
+// caller's buffer, so neither side converts fields or allocates.
+#define PATRIE_RECORD_NO_META 0xFFFFu
+#define PATRIE_RECORD_MAX_KEY 4096
+
+typedef struct {
+    uint32_t size;       // whole record, multiple of 8
+    uint16_t key_len;    // bytes, NUL excluded
+    uint16_t meta_len;   // bytes, NUL excluded, or PATRIE_RECORD_NO_META
+    uint32_t qual;
+    uint32_t id;         // filled by lookup; ignored by insert
+    double score;
+    uint64_t visits;     // filled by lookup; ignored by insert
+} PatrieRecord;
+
+// src/record.rs mirrors this layout field for field.
+_Static_assert(sizeof(PatrieRecord) == 32 && offsetof(PatrieRecord, score) == 16,
+               "PatrieRecord layout is shared with src/record.rs");
+
+static size_t record_size(size_t key_len, size_t meta_len) {
+    size_t n = sizeof(PatrieRecord) + key_len + 1;
+    if (meta_len != PATRIE_RECORD_NO_META) n += meta_len + 1;
+    return (n + 7) & ~(size_t)7;
+}
+
+// Key and meta of a well-formed record of at most len bytes, or 0.
+static int record_check(const PatrieRecord *r, size_t len, const char **key, const char **meta) {
+    if (len < sizeof(PatrieRecord) || r->size > len || r->key_len == 0 || r->key_len > PATRIE_RECORD_MAX_KEY ||
+        r->size != record_size(r->key_len, r->meta_len))
+        return 0;
+    const char *k = (const char *)(r + 1);
+    if (k[r->key_len] != '\0' || memchr(k, '\0', r->key_len)) return 0;
+    *key = k;
+    *meta = NULL;
+    if (r->meta_len != PATRIE_RECORD_NO_META) {
+        const char *m = k + r->key_len + 1;
+        if (m[r->meta_len] != '\0' || memchr(m, '\0', r->meta_len)) return 0;
+        *meta = m;
+    }
+    return 1;
+}
+
+// Inserts one record of at most len bytes; returns -1 if it is malformed.
+int patrie_insert_record(TrieNode *root, const void *rec, size_t len) {
+    const char *key, *meta;
+    if (((uintptr_t)rec & 7) || !record_check(rec, len, &key, &meta)) return -1;
+    const PatrieRecord *r = rec;
+    patrie_insert(root, key, r->score, (QualFlags)r->qual, meta);
+    return 0;
+}
+
+// Inserts the records packed in buf, in order, up to the first malformed
+// one. Returns the number inserted.
+size_t patrie_insert_records(TrieNode *root, const void *buf, size_t len) {
+    const char *p = buf;
+    size_t n = 0;
+    while (len >= sizeof(PatrieRecord) && patrie_insert_record(root, p, len) == 0) {
+        size_t sz = ((const PatrieRecord *)p)->size;
+        p += sz;
+        len -= sz;
+        ++n;
+    }
+    return n;
+}
+
+// Looks key[0..key_len) up like patrie_lookup() and writes its record to
+// out (8-byte aligned, cap bytes). Returns the record size, 0 if key is not
+// stored, or the size needed without writing anything if cap is too small
+// (such a call is not a visit). Returns SIZE_MAX, without a visit, when the
+// result cannot be a record: key is empty, longer than PATRIE_RECORD_MAX_KEY
+// or contains a NUL, out is misaligned, or the stored meta is
+// PATRIE_RECORD_NO_META bytes or longer.
+size_t patrie_lookup_into(TrieNode *root, const char *key, size_t key_len, void *out, size_t cap) {
+    char k[PATRIE_RECORD_MAX_KEY + 1];
+    if (key_len == 0 || key_len > PATRIE_RECORD_MAX_KEY || memchr(key, '\0', key_len) || ((uintptr_t)out & 7))
+        return SIZE_MAX;
+    memcpy(k, key, key_len);
+    k[key_len] = '\0';
+    // Find the row first and count the visit, as patrie_lookup() would, only
+    // once the record is known to fit.
+    Patrie *t = patrie_of(root);
+    TrieNode *path[PATRIE_PATH_MAX], *node = NULL;
+    size_t depth = 0;
+    PhenoId id;
+    if (t->hidx) {
+        const HashSlot *hs = hidx_find(t->hidx, k, str_hash(k));
+        if (!stat_lookup(t, 0, hs != NULL)) return 0;
+        id = hs->id;
+    } else {
+        if (!(node = lookup_node(t, root, k, path, &depth))) return 0;
+        id = node->pid;
+    }
+    Phenotype p;
+    pheno_load(t, id, &p);
+    size_t meta_len = PATRIE_RECORD_NO_META;
+    if (p.meta) {
+        meta_len = strlen(p.meta);
+        if (meta_len >= PATRIE_RECORD_NO_META) return SIZE_MAX;
+    }
+    size_t size = record_size(key_len, meta_len);
+    if (size > cap) return size;
+    if (t->hidx) {
+        p.visits = pheno_visit(t, id);
+        t->visits_stale = 1;
+    } else if (!t->origin) {
+        p.visits = pheno_visit(t, id);
+        agg_raise_visits(root, k, path, depth, p.visits);
+    }
+    PatrieRecord *r = out;
+    r->size = (uint32_t)size;
+    r->key_len = (uint16_t)key_len;
+    r->meta_len = (uint16_t)meta_len;
+    r->qual = (uint32_t)p.qual;
+    r->id = p.id;
+    r->score = p.score;
+    r->visits = p.visits;
+    char *dst = (char *)(r + 1);
+    memcpy(dst, k, key_len + 1);
+    dst += key_len + 1;
+    if (p.meta) {
+        memcpy(dst, p.meta, meta_len);
+        dst[meta_len] = '\0';
+        dst += meta_len + 1;
+    }
+    memset(dst, 0, (size_t)((char *)out + size - dst));
+    return size;
 }
 
-static void trie_free(TrieNode *node) {
-    if (!node) return;
-    avl_inorder(node->children, visit_free_fn, NULL);
-    avl_free(node->children);
-    if (node->p) phenotype_free(node->p);
-    free(node);
+// Releases a trie created through the ABI (trie_free() for foreign callers).
+void patrie_free(TrieNode *root) {
+    trie_free(root);
 }
 
 // --------------------- Example ---------------------
-static void print_token(const char *token, Phenotype *p, void *ctx) {
+// bench.c includes this file with PATRIE_NO_EXAMPLE defined to reuse the trie
+// without the demo.
+#ifndef PATRIE_NO_EXAMPLE
+typedef struct {
+    uint64_t visits[3];
+    size_t n;
+} VisitsSeen;
+
+static void note_visits(const char *token, const Phenotype *p, void *ctx) {
+    (void)token;
+    VisitsSeen *v = ctx;
+    if (v->n < 3) v->visits[v->n] = p->visits;
+    v->n++;
+}
+
+// Top-K by visits on a snapshot must see visits the live trie records after
+// an insert has path-copied the snapshot's nodes.
+static int check_snapshot_topk(void) {
+    TrieNode *root = patrie_new();
+    patrie_insert(root, "apple1", 0.1, QUAL_NONE, NULL);
+    patrie_insert(root, "apple2", 0.2, QUAL_NONE, NULL);
+    patrie_insert(root, "banana", 0.3, QUAL_NONE, NULL);
+    for (int i = 0; i < 5; ++i) patrie_lookup(root, "banana", NULL);
+    TrieNode *snap = patrie_snapshot(root);
+    patrie_insert(root, "apple3", 0.4, QUAL_NONE, NULL);
+    for (int i = 0; i < 100; ++i) patrie_lookup(root, "apple1", NULL);
+    VisitsSeen top1 = {0}, top3 = {0};
+    patrie_topk(snap, NULL, 1, PATRIE_BY_VISITS, note_visits, &top1);
+    patrie_topk(snap, NULL, 3, PATRIE_BY_VISITS, note_visits, &top3);
+    int ok = top1.n == 1 && top1.visits[0] == 100 && top3.n == 3 &&
+             top3.visits[0] == 100 && top3.visits[1] == 5 && top3.visits[2] == 0;
+    patrie_snapshot_release(snap);
+    trie_free(root);
+    return ok;
+}
+
+static void print_token(const char *token, const Phenotype *p, void *ctx) {
     (void)ctx;
     printf("token='%s' score=%.3f visits=%" PRIu64 " qual=0x%x meta=%s\n",
            token, p ? p->score : 0.0, p ? p->visits : 0, p ? p->qual : 0,
            (p && p->meta) ? p->meta : "NULL");
 }
 
-int main(void) {
-    TrieNode *root = trie_node_new();
+// Usage: phenotype [-o file [-m | -t]]
+//   With -o the enumeration is exported to file as binary phenotype blocks
+//   (-m: mmap-backed writer, -t: text lines; "-" is stdout with -t) instead
+//   of printed.
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    PlpSinkMode mode = PLP_SINK_BINARY;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:mt")) != -1) {
+        switch (opt) {
+        case 'o': path = optarg; break;
+        case 'm': mode = PLP_SINK_MMAP; break;
+        case 't': mode = PLP_SINK_TEXT; break;
+        default:
+            fprintf(stderr, "usage: %s [-o file [-m | -t]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    TrieNode *root = patrie_new();
 
     patrie_insert(root, "phenotype", 0.72, QUAL_RESILIENT | QUAL_CREATIVE, "root concept");
     patrie_insert(root, "phenovalude", 0.85, QUAL_OPTIMIST, "value metric");
     patrie_insert(root, "phoneme", 0.45, QUAL_ANXIOUS, "sound unit");
 
-    Phenotype *p = patrie_lookup(root, "phenotype");
-    if (p) printf("Found phenotype -> score %.2f meta=%s\n", p->score, p->meta);
+    Phenotype p;
+    if (patrie_lookup(root, "phenotype", &p)) printf("Found phenotype -> score %.2f meta=%s\n", p.score, p.meta);
 
-    printf("Enumerate all tokens:\n");
-    patrie_enumerate(root, print_token, NULL);
+    if (path) {
+        PlpSink *sink = plp_sink_open(path, mode);
+        if (!sink) { perror(path); trie_free(root); return 1; }
+        size_t n = patrie_export(root, sink);
+        if (plp_sink_close(sink) != 0) { perror(path); trie_free(root); return 1; }
+        printf("Exported %zu tokens to %s\n", n, path);
+    } else {
+        printf("Enumerate all tokens:\n");
+        patrie_enumerate(root, print_token, NULL);
+    }
 
     trie_free(root);
-    return 0;
+    int ok = check_snapshot_topk();
+    printf("Snapshot top-K by visits follows the live trie: %s\n", ok ? "yes" : "NO");
+    return ok ? 0 : 1;
 }
+#endif
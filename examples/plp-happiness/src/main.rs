@@ -4,6 +4,9 @@ use serde::{Serialize, Deserialize};
 use ring::digest;
 use std::hash::Hash;
 
+mod record;
+use record::{FourDTensorView, Patrie, RecordBuf};
+
 // DIRAM integrity enum (2-bit packing)
 #[derive(Debug, Clone, Copy, PartialEq, Serialize, Deserialize)]
 #[repr(u8)]
@@ -452,6 +455,23 @@ fn main() {
     let motion_plan = tensor.plan_motion(&phenomenohog, &emotional_state);
     println!("🛤️ Motion plan: {:?}", motion_plan);
 
+    // Hand the block to the C patrie as a binary record and read it back in place
+    let mut records = RecordBuf::new();
+    phenomenohog.encode_record(&mut records);
+    let mut patrie = Patrie::new();
+    println!("📦 Inserted {} record(s) into the C patrie ({} bytes)", patrie.insert_all(&records), records.len());
+    let mut found = RecordBuf::new();
+    if let Ok(Some(rec)) = patrie.lookup_into(b"sess-42/government_id", &mut found) {
+        let h = rec.header();
+        println!("🔎 {} -> score {:.3} qual 0x{:x} visits {} meta {}", String::from_utf8_lossy(rec.key()),
+                 h.score, h.qual, h.visits, String::from_utf8_lossy(rec.meta().unwrap_or(b"NULL")));
+    }
+    let mut words = Vec::new();
+    tensor.encode_into(&mut words);
+    if let Some(view) = FourDTensorView::from_words(&words) {
+        println!("🧊 Tensor {:?} encoded in {} bytes, cell (1,2,3,4) = {}", view.dims, words.len() * 8, view.at(1, 2, 3, 4));
+    }
+
     let mut diram_manager = DIRAMManager::new();
     if diram_manager.transition_state(DIRAMState::Partial).is_ok() {
         println!("🔄 DIRAM state transitioned to Partial");
@@ -0,0 +1,447 @@
+// Fixed-layout binary records shared with the C patrie (pheno_happiness/main.c,
+// "Record ABI"). A record is a PatrieRecord header, the key, a NUL, the meta
+// string and a NUL (unless meta_len is NO_META), zero-padded to a multiple of
+// 8 bytes. Records are built straight into an 8-byte aligned buffer and read
+// back in place, so crossing the FFI boundary needs no text encoding, no
+// per-field conversion and no allocation once the buffers have grown.
+use std::os::raw::{c_char, c_int, c_void};
+
+use crate::{Diram, FourDTensor, PhenomenohogBlock};
+
+pub const NO_META: u16 = 0xFFFF;
+pub const MAX_KEY: usize = 4096;
+
+pub const QUAL_RESILIENT: u32 = 1 << 0;
+pub const QUAL_CREATIVE: u32 = 1 << 1;
+pub const QUAL_ANXIOUS: u32 = 1 << 2;
+pub const QUAL_OPTIMIST: u32 = 1 << 3;
+
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct PatrieRecord {
+    pub size: u32,
+    pub key_len: u16,
+    pub meta_len: u16,
+    pub qual: u32,
+    pub id: u32,
+    pub score: f64,
+    pub visits: u64,
+}
+
+// Same checks as the _Static_assert next to the C definition.
+const _: () = assert!(std::mem::size_of::<PatrieRecord>() == 32
+                      && std::mem::offset_of!(PatrieRecord, score) == 16);
+
+const HEADER: usize = std::mem::size_of::<PatrieRecord>();
+
+fn record_size(key_len: usize, meta_len: Option<usize>) -> usize {
+    let n = HEADER + key_len + 1 + meta_len.map_or(0, |m| m + 1);
+    (n + 7) & !7
+}
+
+// Opaque C trie.
+#[repr(C)]
+pub struct TrieNode {
+    _private: [u8; 0],
+}
+
+extern "C" {
+    fn patrie_new() -> *mut TrieNode;
+    fn patrie_free(root: *mut TrieNode);
+    fn patrie_insert_record(root: *mut TrieNode, rec: *const c_void, len: usize) -> c_int;
+    fn patrie_insert_records(root: *mut TrieNode, buf: *const c_void, len: usize) -> usize;
+    fn patrie_lookup_into(root: *mut TrieNode, key: *const c_char, key_len: usize, out: *mut c_void, cap: usize) -> usize;
+}
+
+// Records packed back to back in u64 words, which keeps every record 8-byte
+// aligned. clear() keeps the capacity, so a reused buffer stops allocating.
+#[derive(Default)]
+pub struct RecordBuf {
+    words: Vec<u64>,
+}
+
+impl RecordBuf {
+    pub fn new() -> Self { RecordBuf { words: Vec::new() } }
+    pub fn clear(&mut self) { self.words.clear(); }
+    pub fn len(&self) -> usize { self.words.len() * 8 }
+    pub fn is_empty(&self) -> bool { self.words.is_empty() }
+
+    pub fn as_bytes(&self) -> &[u8] {
+        // u64 words viewed as bytes: same memory, stricter alignment than needed
+        unsafe { std::slice::from_raw_parts(self.words.as_ptr() as *const u8, self.len()) }
+    }
+
+    // Appends one record whose key is the concatenation of key_parts, so
+    // composite keys need no intermediate String. Returns false (and appends
+    // nothing) if the key is empty, too long or contains a NUL, or if meta is
+    // NO_META bytes or longer or contains a NUL.
+    pub fn push(&mut self, key_parts: &[&[u8]], score: f64, qual: u32, meta: Option<&[u8]>) -> bool {
+        let key_len: usize = key_parts.iter().map(|p| p.len()).sum();
+        if key_len == 0 || key_len > MAX_KEY || key_parts.iter().any(|p| p.contains(&0)) {
+            return false;
+        }
+        if meta.map_or(false, |m| m.len() >= NO_META as usize || m.contains(&0)) {
+            return false;
+        }
+        let size = record_size(key_len, meta.map(|m| m.len()));
+        let at = self.words.len();
+        self.words.resize(at + size / 8, 0);
+        let bytes = unsafe {
+            std::slice::from_raw_parts_mut(self.words.as_mut_ptr().add(at) as *mut u8, size)
+        };
+        let hdr = PatrieRecord {
+            size: size as u32,
+            key_len: key_len as u16,
+            meta_len: meta.map_or(NO_META, |m| m.len() as u16),
+            qual,
+            id: 0,
+            score,
+            visits: 0,
+        };
+        unsafe { std::ptr::write(bytes.as_mut_ptr() as *mut PatrieRecord, hdr) };
+        let mut off = HEADER;
+        for p in key_parts {
+            bytes[off..off + p.len()].copy_from_slice(p);
+            off += p.len();
+        }
+        off += 1; // NUL, already zero
+        if let Some(m) = meta {
+            bytes[off..off + m.len()].copy_from_slice(m);
+        }
+        true
+    }
+
+    pub fn iter(&self) -> RecordIter<'_> {
+        RecordIter { rest: self.as_bytes() }
+    }
+}
+
+// A record borrowed from an aligned byte buffer.
+#[derive(Clone, Copy)]
+pub struct RecordRef<'a> {
+    bytes: &'a [u8],
+}
+
+impl<'a> RecordRef<'a> {
+    // Checks the layout the C side relies on; None if bytes does not start
+    // with a well-formed record.
+    pub fn from_bytes(bytes: &'a [u8]) -> Option<Self> {
+        if bytes.len() < HEADER || (bytes.as_ptr() as usize) % 8 != 0 {
+            return None;
+        }
+        let h = unsafe { &*(bytes.as_ptr() as *const PatrieRecord) };
+        let meta = if h.meta_len == NO_META { None } else { Some(h.meta_len as usize) };
+        let size = h.size as usize;
+        if size > bytes.len() || h.key_len == 0 || size != record_size(h.key_len as usize, meta) {
+            return None;
+        }
+        Some(RecordRef { bytes: &bytes[..size] })
+    }
+
+    pub fn header(&self) -> &'a PatrieRecord {
+        unsafe { &*(self.bytes.as_ptr() as *const PatrieRecord) }
+    }
+
+    pub fn key(&self) -> &'a [u8] {
+        &self.bytes[HEADER..HEADER + self.header().key_len as usize]
+    }
+
+    pub fn meta(&self) -> Option<&'a [u8]> {
+        let h = self.header();
+        if h.meta_len == NO_META {
+            return None;
+        }
+        let at = HEADER + h.key_len as usize + 1;
+        Some(&self.bytes[at..at + h.meta_len as usize])
+    }
+}
+
+pub struct RecordIter<'a> {
+    rest: &'a [u8],
+}
+
+impl<'a> Iterator for RecordIter<'a> {
+    type Item = RecordRef<'a>;
+    fn next(&mut self) -> Option<RecordRef<'a>> {
+        let r = RecordRef::from_bytes(self.rest)?;
+        self.rest = &self.rest[r.bytes.len()..];
+        Some(r)
+    }
+}
+
+// Why a lookup result cannot be expressed as a record.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum RecordError {
+    InvalidKey,    // empty, longer than MAX_KEY or containing a NUL
+    MetaTooLong,   // the stored meta is NO_META bytes or longer
+}
+
+// Owning handle on a C trie.
+pub struct Patrie {
+    root: *mut TrieNode,
+}
+
+impl Patrie {
+    pub fn new() -> Self { Patrie { root: unsafe { patrie_new() } } }
+
+    pub fn insert(&mut self, rec: RecordRef<'_>) -> bool {
+        unsafe { patrie_insert_record(self.root, rec.bytes.as_ptr() as *const c_void, rec.bytes.len()) == 0 }
+    }
+
+    // One FFI call for the whole buffer; returns the number of records inserted.
+    pub fn insert_all(&mut self, buf: &RecordBuf) -> usize {
+        unsafe { patrie_insert_records(self.root, buf.words.as_ptr() as *const c_void, buf.len()) }
+    }
+
+    // Looks key up (bumping its visits, as patrie_lookup does) and returns its
+    // record inside out, which grows only when a record does not fit. The
+    // first try leaves room for 256 bytes of meta; a try that does not fit is
+    // not counted as a visit. Ok(None) if key is not stored.
+    pub fn lookup_into<'a>(&mut self, key: &[u8], out: &'a mut RecordBuf)
+                           -> Result<Option<RecordRef<'a>>, RecordError> {
+        if key.is_empty() || key.len() > MAX_KEY || key.contains(&0) {
+            return Err(RecordError::InvalidKey);
+        }
+        out.words.clear();
+        out.words.reserve(record_size(key.len(), Some(256)) / 8);
+        loop {
+            let cap = out.words.capacity() * 8;
+            let n = unsafe {
+                patrie_lookup_into(self.root, key.as_ptr() as *const c_char, key.len(),
+                                   out.words.as_mut_ptr() as *mut c_void, cap)
+            };
+            if n == 0 {
+                return Ok(None);
+            }
+            if n == usize::MAX {
+                return Err(RecordError::MetaTooLong);   // the key and buffer are valid
+            }
+            if n <= cap {
+                // the C side wrote all n bytes, padding included
+                unsafe { out.words.set_len(n / 8) };
+                return Ok(RecordRef::from_bytes(out.as_bytes()));
+            }
+            out.words.reserve(n / 8);
+        }
+    }
+}
+
+impl Drop for Patrie {
+    fn drop(&mut self) {
+        unsafe { patrie_free(self.root) };
+    }
+}
+
+impl PhenomenohogBlock {
+    // Appends this block as a patrie record: key "<session>/<type_field>",
+    // score the mean of the Apex-14 profile, meta the description. Intact
+    // blocks are RESILIENT, collapsed ones ANXIOUS, and blocks with cultural
+    // markers CREATIVE.
+    pub fn encode_record(&self, out: &mut RecordBuf) -> bool {
+        let p = &self.apex_14_profile;
+        let apex = [p.visual, p.auditory, p.tactile, p.olfactory, p.gustatory, p.vestibular,
+                    p.proprioceptive, p.temporal, p.emotional, p.cognitive, p.cultural,
+                    p.spiritual, p.intentional, p.relational];
+        let score = apex.iter().map(|&v| v as f64).sum::<f64>() / apex.len() as f64;
+        let mut qual = match Diram::from(self.diram_state) {
+            Diram::Intact => QUAL_RESILIENT,
+            Diram::Collapse => QUAL_ANXIOUS,
+            _ => 0,
+        };
+        if !self.cultural_markers.is_empty() {
+            qual |= QUAL_CREATIVE;
+        }
+        out.push(&[self.session.as_bytes(), b"/", self.type_field.as_bytes()], score, qual,
+                 Some(self.description.as_bytes()))
+    }
+}
+
+// FourDTensor in the same spirit: four u64 dims, then the f64 cells in
+// row-major order, all in u64 words so a view can borrow the cells in place.
+pub struct FourDTensorView<'a> {
+    pub dims: [usize; 4],
+    pub data: &'a [f64],
+}
+
+impl FourDTensor {
+    pub fn encode_into(&self, out: &mut Vec<u64>) {
+        out.clear();
+        out.extend(self.dims.iter().map(|&d| d as u64));
+        out.extend(self.data.iter().map(|v| v.to_bits()));
+    }
+}
+
+impl<'a> FourDTensorView<'a> {
+    pub fn from_words(words: &'a [u64]) -> Option<Self> {
+        if words.len() < 4 {
+            return None;
+        }
+        let dims = [words[0] as usize, words[1] as usize, words[2] as usize, words[3] as usize];
+        let cells = dims.iter().try_fold(1usize, |acc, &d| acc.checked_mul(d))?;
+        if words.len() - 4 != cells {
+            return None;
+        }
+        // f64 and u64 share size and alignment, and the bits were written by to_bits()
+        let data = unsafe { std::slice::from_raw_parts(words[4..].as_ptr() as *const f64, cells) };
+        Some(FourDTensorView { dims, data })
+    }
+
+    pub fn at(&self, i: usize, j: usize, k: usize, t: usize) -> f64 {
+        let [_, d1, d2, d3] = self.dims;
+        self.data[((i * d1 + j) * d2 + k) * d3 + t]
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::Apex14Profile;
+    use chrono::Utc;
+
+    fn block(diram_state: u8) -> PhenomenohogBlock {
+        PhenomenohogBlock {
+            session: "sess-1".to_string(),
+            scope: "person".to_string(),
+            type_field: "name".to_string(),
+            description: "given name".to_string(),
+            timestamp: Utc::now(),
+            frame_of_reference: "user:test".to_string(),
+            apex_14_profile: Apex14Profile {
+                visual: 0.5, auditory: 0.5, tactile: 0.5, olfactory: 0.5, gustatory: 0.5,
+                vestibular: 0.5, proprioceptive: 0.5, temporal: 0.5, emotional: 0.5,
+                cognitive: 0.5, cultural: 0.5, spiritual: 0.5, intentional: 0.5, relational: 0.5,
+            },
+            diram_state,
+            cultural_markers: vec!["marker".to_string()],
+        }
+    }
+
+    #[test]
+    fn round_trips_records_through_the_c_trie() {
+        let mut buf = RecordBuf::new();
+        for i in 0..1001 {
+            let meta = if i % 2 == 1 { Some(&b"odd"[..]) } else { None };
+            assert!(buf.push(&[b"k/", i.to_string().as_bytes()], i as f64, i as u32 & 0xF, meta));
+        }
+        assert_eq!(buf.iter().count(), 1001);
+        assert_eq!(buf.len() % 8, 0);
+
+        let mut trie = Patrie::new();
+        assert_eq!(trie.insert_all(&buf), 1001);
+        let mut out = RecordBuf::new();
+        for i in 0..1001 {
+            let key = format!("k/{i}");
+            let rec = trie.lookup_into(key.as_bytes(), &mut out).unwrap().expect("stored key");
+            assert_eq!(rec.key(), key.as_bytes());
+            assert_eq!(rec.header().score, i as f64);
+            assert_eq!(rec.header().qual, i as u32 & 0xF);
+            assert_eq!(rec.header().visits, 1);
+            assert_eq!(rec.meta(), if i % 2 == 1 { Some(&b"odd"[..]) } else { None });
+        }
+        assert!(trie.lookup_into(b"k/1001", &mut out).unwrap().is_none());
+        assert!(trie.lookup_into(b"k/", &mut out).unwrap().is_none());
+    }
+
+    #[test]
+    fn rejects_malformed_keys_and_meta() {
+        let mut buf = RecordBuf::new();
+        assert!(!buf.push(&[], 0.0, 0, None));
+        assert!(!buf.push(&[b"", b""], 0.0, 0, None));
+        assert!(!buf.push(&[b"a\0b"], 0.0, 0, None));
+        assert!(!buf.push(&[&[b'k'; MAX_KEY + 1]], 0.0, 0, None));
+        assert!(!buf.push(&[b"k"], 0.0, 0, Some(b"a\0b")));
+        let long = vec![b'm'; NO_META as usize];
+        assert!(!buf.push(&[b"k"], 0.0, 0, Some(&long)));
+        assert!(buf.is_empty());
+        assert!(buf.push(&[&[b'k'; MAX_KEY]], 0.0, 0, Some(&long[..NO_META as usize - 1])));
+    }
+
+    #[test]
+    fn rejects_truncated_and_misaligned_records() {
+        let mut buf = RecordBuf::new();
+        assert!(buf.push(&[b"key"], 1.0, 0, Some(b"meta")));
+        let bytes = buf.as_bytes();
+        assert!(RecordRef::from_bytes(&bytes[..bytes.len() - 8]).is_none());
+        assert!(RecordRef::from_bytes(&bytes[1..]).is_none());
+        let root = unsafe { patrie_new() };
+        unsafe {
+            assert_eq!(patrie_insert_record(root, bytes.as_ptr() as *const c_void, bytes.len() - 8), -1);
+            assert_eq!(patrie_insert_record(root, bytes.as_ptr().add(1) as *const c_void, bytes.len() - 1), -1);
+            assert_eq!(patrie_insert_record(root, bytes.as_ptr() as *const c_void, bytes.len()), 0);
+            patrie_free(root);
+        }
+    }
+
+    #[test]
+    fn lookup_grows_the_buffer_for_long_meta() {
+        let meta = vec![b'x'; 4000];
+        let mut buf = RecordBuf::new();
+        assert!(buf.push(&[b"long"], 2.0, 0, Some(&meta)));
+        let mut trie = Patrie::new();
+        assert!(trie.insert(buf.iter().next().unwrap()));
+        let mut out = RecordBuf::new();
+        let rec = trie.lookup_into(b"long", &mut out).unwrap().unwrap();
+        assert_eq!(rec.meta(), Some(&meta[..]));
+        assert_eq!(rec.header().visits, 1);   // the too-small first try is not a visit
+        let rec = trie.lookup_into(b"long", &mut out).unwrap().unwrap();
+        assert_eq!(rec.header().visits, 2);
+    }
+
+    #[test]
+    fn tells_errors_from_absent_keys() {
+        extern "C" {
+            fn patrie_insert(root: *mut TrieNode, key: *const c_char, score: f64, qual: c_int, meta: *const c_char);
+        }
+        let mut trie = Patrie::new();
+        let mut out = RecordBuf::new();
+        assert_eq!(trie.lookup_into(b"", &mut out).err(), Some(RecordError::InvalidKey));
+        assert_eq!(trie.lookup_into(b"a\0b", &mut out).err(), Some(RecordError::InvalidKey));
+        assert_eq!(trie.lookup_into(&[b'k'; MAX_KEY + 1], &mut out).err(), Some(RecordError::InvalidKey));
+        assert!(trie.lookup_into(&[b'k'; MAX_KEY], &mut out).unwrap().is_none());
+
+        // meta only the C API can store
+        let mut meta = vec![b'm'; NO_META as usize];
+        meta.push(0);
+        unsafe { patrie_insert(trie.root, b"big\0".as_ptr() as *const c_char, 1.0, 0, meta.as_ptr() as *const c_char) };
+        assert_eq!(trie.lookup_into(b"big", &mut out).err(), Some(RecordError::MetaTooLong));
+
+        // none of the failed lookups counted as a visit
+        let mut buf = RecordBuf::new();
+        assert!(buf.push(&[b"big"], 2.0, 0, None));
+        assert!(trie.insert(buf.iter().next().unwrap()));
+        assert_eq!(trie.lookup_into(b"big", &mut out).unwrap().unwrap().header().visits, 1);
+    }
+
+    #[test]
+    fn encodes_phenomenohog_blocks() {
+        let mut buf = RecordBuf::new();
+        assert!(block(0b11).encode_record(&mut buf));
+        assert!(block(0b10).encode_record(&mut buf));
+        let recs: Vec<RecordRef> = buf.iter().collect();
+        assert_eq!(recs.len(), 2);
+        assert_eq!(recs[0].key(), b"sess-1/name");
+        assert_eq!(recs[0].meta(), Some(&b"given name"[..]));
+        assert!((recs[0].header().score - 0.5).abs() < 1e-12);
+        assert_eq!(recs[0].header().qual, QUAL_RESILIENT | QUAL_CREATIVE);
+        assert_eq!(recs[1].header().qual, QUAL_ANXIOUS | QUAL_CREATIVE);
+    }
+
+    #[test]
+    fn views_an_encoded_tensor_in_place() {
+        let mut tensor = FourDTensor::new([2, 3, 4, 5]);
+        for (i, v) in tensor.data.iter_mut().enumerate() {
+            *v = i as f64;
+        }
+        let mut words = Vec::new();
+        tensor.encode_into(&mut words);
+        assert_eq!(words.len(), 4 + 120);
+        let view = FourDTensorView::from_words(&words).unwrap();
+        assert_eq!(view.dims, [2, 3, 4, 5]);
+        assert_eq!(view.at(1, 2, 3, 4), 119.0);
+        assert_eq!(view.at(0, 1, 0, 2), 22.0);
+        assert!(FourDTensorView::from_words(&words[..3]).is_none());
+        assert!(FourDTensorView::from_words(&words[..words.len() - 1]).is_none());
+        words[0] = u64::MAX;
+        assert!(FourDTensorView::from_words(&words).is_none());
+    }
+}
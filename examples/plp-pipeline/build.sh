@@ -0,0 +1 @@
+gcc -O2 -Wa,--noexecstack -Wl,-z,noexecstack -o plp_pipeline pipeline.c -lm -pthread
@@ -0,0 +1,305 @@
+// In-process pipeline from function observations to the phenotype trie.
+// Observer threads sweep a model and label every sample as a phenotype row;
+// full batches travel through a bounded lock-free queue to a single writer
+// that inserts them, so observation and indexing overlap. Batches come from a
+// fixed pool and go back to it once inserted: when the writer falls behind,
+// observers wait for a free batch (backpressure) instead of buffering without
+// bound.
+//   ./plp_pipeline [-n samples] [-t observers] [model]
+#define PATRIE_NO_EXAMPLE
+#include "../plp-happiness/pheno_happiness/main.c"
+#define PLP_NO_EXAMPLE
+#include "../plp-function-model/plp_function_model.c"
+
+#include <sched.h>
+
+#define PIPE_BATCH    1024   // rows per batch
+#define PIPE_DEPTH    64     // batches in the pool, and queue capacity (a power of two)
+#define PIPE_KEY      40     // model name, '/', 16 hex digits, NUL
+#define PIPE_MAX_OBSERVERS 64
+
+// --------------------- Labelling ---------------------
+// Keys are "<model>/<x as 16 hex digits>", where the digits are the bits of x
+// mapped so that unsigned order is numeric order; enumeration then walks a
+// model's samples by increasing x.
+static size_t pipe_key(char *dst, const char *model, double x) {
+    uint64_t b;
+    memcpy(&b, &x, sizeof(b));
+    b = (b >> 63) ? ~b : b | (1ull << 63);
+    size_t n = strlen(model);
+    if (n > PIPE_KEY - 18) n = PIPE_KEY - 18;
+    memcpy(dst, model, n);
+    dst[n++] = '/';
+    for (int i = 15; i >= 0; --i) dst[n++] = "0123456789abcdef"[(b >> (4 * i)) & 15];
+    dst[n] = '\0';
+    return n;
+}
+
+static double pipe_key_x(const char *key) {
+    const char *h = strchr(key, '/') + 1;
+    uint64_t b = strtoull(h, NULL, 16);
+    b = (b >> 63) ? b & ~(1ull << 63) : ~b;
+    double x;
+    memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+static QualFlags pipe_qual(double x, double y, double c) {
+    unsigned q = QUAL_NONE;
+    if (c >= 0.9) q |= QUAL_RESILIENT;
+    if (c < 0.4) q |= QUAL_ANXIOUS;
+    if (y > 0) q |= QUAL_OPTIMIST;
+    if (fabs(y) > fabs(x)) q |= QUAL_CREATIVE;
+    return (QualFlags)q;
+}
+
+// --------------------- Queue ---------------------
+// Bounded multi-producer multi-consumer ring (Vyukov): each cell carries a
+// sequence number telling whether it is free for the push or the pop of the
+// current lap, so producers and consumers only contend on their own cursor.
+typedef struct {
+    size_t n;
+    double score[PIPE_BATCH];
+    QualFlags qual[PIPE_BATCH];
+    char key[PIPE_BATCH][PIPE_KEY];
+} PipeBatch;
+
+typedef struct {
+    size_t seq;
+    PipeBatch *item;
+} PipeCell;
+
+typedef struct {
+    PipeCell cell[PIPE_DEPTH];
+    char pad0[64];
+    size_t head;   // next push
+    char pad1[64];
+    size_t tail;   // next pop
+} PipeQueue;
+
+static void pipe_queue_init(PipeQueue *q) {
+    memset(q, 0, sizeof(*q));
+    for (size_t i = 0; i < PIPE_DEPTH; ++i) q->cell[i].seq = i;
+}
+
+static int pipe_push(PipeQueue *q, PipeBatch *b) {
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for (;;) {
+        PipeCell *c = &q->cell[pos & (PIPE_DEPTH - 1)];
+        intptr_t d = (intptr_t)(__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - pos);
+        if (d == 0) {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                c->item = b;
+                __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (d < 0) {
+            return 0;   // full
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static PipeBatch* pipe_pop(PipeQueue *q) {
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        PipeCell *c = &q->cell[pos & (PIPE_DEPTH - 1)];
+        intptr_t d = (intptr_t)(__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (d == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                PipeBatch *b = c->item;
+                __atomic_store_n(&c->seq, pos + PIPE_DEPTH, __ATOMIC_RELEASE);
+                return b;
+            }
+        } else if (d < 0) {
+            return NULL;   // empty
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Spins briefly, then yields the CPU; *stalls counts the waits that got
+// that far.
+static void pipe_wait(unsigned *spins, uint64_t *stalls) {
+    if (++*spins < 64) return;
+    if (*spins == 64) ++*stalls;
+    sched_yield();
+}
+
+// --------------------- Pipeline ---------------------
+typedef struct {
+    size_t samples, batches;
+    uint64_t observer_stalls;   // waits for a free batch (backpressure)
+    uint64_t writer_stalls;     // waits for a full batch
+    double secs;
+} PipeStats;
+
+typedef struct {
+    const PLP_Function *fn;
+    double lo, step;
+    size_t n, nbatches;
+    size_t next;                // next batch index to observe
+    PipeQueue full, free;
+    uint64_t observer_stalls;
+} PipeJob;
+
+static void *pipe_observer(void *arg) {
+    PipeJob *job = arg;
+    double xs[PIPE_BATCH], out[PIPE_BATCH], coh[PIPE_BATCH];
+    uint64_t stalls = 0;
+    size_t k;
+    while ((k = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->nbatches) {
+        size_t i0 = k * PIPE_BATCH, n = job->n - i0 < PIPE_BATCH ? job->n - i0 : PIPE_BATCH;
+        for (size_t i = 0; i < n; ++i) xs[i] = job->lo + (double)(i0 + i) * job->step;
+        plp_observe_batch_with(job->fn, xs, n, out, coh);
+        PipeBatch *b;
+        unsigned spins = 0;
+        while (!(b = pipe_pop(&job->free))) pipe_wait(&spins, &stalls);
+        b->n = n;
+        for (size_t i = 0; i < n; ++i) {
+            pipe_key(b->key[i], job->fn->name, xs[i]);
+            b->score[i] = coh[i];
+            b->qual[i] = pipe_qual(xs[i], out[i], coh[i]);
+        }
+        spins = 0;
+        while (!pipe_push(&job->full, b)) pipe_wait(&spins, &stalls);   // cannot stay full: the pool is no larger
+    }
+    __atomic_fetch_add(&job->observer_stalls, stalls, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Observes fn at lo, lo + step, ... up to hi on observers threads (0 = one
+// per online CPU) and inserts one row per sample into root from the calling
+// thread: score is the coherence, meta the model name. Returns -1 on an
+// empty or malformed range.
+int plp_pipeline_run(TrieNode *root, const PLP_Function *fn, double lo, double hi, double step,
+                     int observers, PipeStats *out) {
+    memset(out, 0, sizeof(*out));
+    if (!(step > 0) || !(hi >= lo) || !isfinite(lo) || !isfinite(hi)) return -1;
+    double span = floor((hi - lo) / step + 1e-9);
+    if (!(span < (double)SIZE_MAX / 2)) return -1;
+    PipeJob *job = calloc(1, sizeof(PipeJob));
+    PipeBatch *pool = malloc(PIPE_DEPTH * sizeof(PipeBatch));
+    if (!job || !pool) { perror("malloc"); exit(1); }
+    job->fn = fn;
+    job->lo = lo;
+    job->step = step;
+    job->n = (size_t)span + 1;
+    job->nbatches = (job->n + PIPE_BATCH - 1) / PIPE_BATCH;
+    pipe_queue_init(&job->full);
+    pipe_queue_init(&job->free);
+    for (size_t i = 0; i < PIPE_DEPTH; ++i) pipe_push(&job->free, &pool[i]);
+    if (observers <= 0) observers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (observers > PIPE_MAX_OBSERVERS) observers = PIPE_MAX_OBSERVERS;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_t tid[PIPE_MAX_OBSERVERS];
+    for (int t = 0; t < observers; ++t)
+        if (pthread_create(&tid[t], NULL, pipe_observer, job) != 0) { perror("pthread_create"); exit(1); }
+
+    uint64_t stalls = 0;
+    for (size_t done = 0; done < job->nbatches; ++done) {
+        PipeBatch *b;
+        unsigned spins = 0;
+        while (!(b = pipe_pop(&job->full))) pipe_wait(&spins, &stalls);
+        for (size_t i = 0; i < b->n; ++i) patrie_insert(root, b->key[i], b->score[i], b->qual[i], fn->name);
+        out->samples += b->n;
+        pipe_push(&job->free, b);
+    }
+    for (int t = 0; t < observers; ++t) pthread_join(tid[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    out->batches = job->nbatches;
+    out->observer_stalls = job->observer_stalls;
+    out->writer_stalls = stalls;
+    out->secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    free(pool);
+    free(job);
+    return 0;
+}
+
+// --------------------- Example ---------------------
+static double pipe_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// The serial baseline: observe everything, then insert everything.
+static double pipe_serial(TrieNode *root, const PLP_Function *fn, double lo, double step, size_t n) {
+    double *xs = malloc(n * sizeof(double)), *out = malloc(n * sizeof(double)), *coh = malloc(n * sizeof(double));
+    if (!xs || !out || !coh) { perror("malloc"); exit(1); }
+    double t0 = pipe_seconds();
+    for (size_t i = 0; i < n; ++i) xs[i] = lo + (double)i * step;
+    plp_observe_batch_with(fn, xs, n, out, coh);
+    char key[PIPE_KEY];
+    for (size_t i = 0; i < n; ++i) {
+        pipe_key(key, fn->name, xs[i]);
+        patrie_insert(root, key, coh[i], pipe_qual(xs[i], out[i], coh[i]), fn->name);
+    }
+    double t = pipe_seconds() - t0;
+    free(xs); free(out); free(coh);
+    return t;
+}
+
+static int pipe_print(const char *token, const Phenotype *p, void *ctx) {
+    (void)ctx;
+    printf("  %s  x=%+.5f score=%.3f qual=0x%x meta=%s\n", token, pipe_key_x(token), p->score, p->qual, p->meta);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t n = 1000000;
+    int observers = 0, opt;
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+        case 'n': n = strtoull(optarg, NULL, 10); break;
+        case 't': observers = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n samples] [-t observers] [model]\n", argv[0]);
+            return 2;
+        }
+    }
+    const PLP_Function *fn = optind < argc ? plp_function_find(argv[optind]) : &plp_functions[0];
+    if (!fn || n < 2) {
+        fprintf(stderr, "unknown model or bad sample count\n");
+        return 1;
+    }
+    double lo = -100.0, hi = 100.0, step = (hi - lo) / (double)(n - 1);
+
+    TrieNode *serial = patrie_new();
+    double ts = pipe_serial(serial, fn, lo, step, n);
+    TrieNode *root = patrie_new();
+    PipeStats st;
+    plp_pipeline_run(root, fn, lo, hi, step, observers, &st);
+
+    int same = patrie_pheno_count(root) == patrie_pheno_count(serial);
+    PatrieCursor *a = patrie_cursor_open(root, NULL, 1), *b = patrie_cursor_open(serial, NULL, 1);
+    const char *ka, *kb;
+    Phenotype pa, pb;
+    while (same && patrie_cursor_next(a, &ka, &pa)) {
+        same = patrie_cursor_next(b, &kb, &pb) && strcmp(ka, kb) == 0 && pa.score == pb.score && pa.qual == pb.qual;
+    }
+    patrie_cursor_close(a);
+    patrie_cursor_close(b);
+
+    printf("%s: %zu samples | serial observe-then-insert %.3fs | pipeline %.3fs (%zu batches, "
+           "%" PRIu64 " observer stalls, %" PRIu64 " writer stalls) | same trie: %s\n",
+           fn->name, st.samples, ts, st.secs, st.batches, st.observer_stalls, st.writer_stalls, same ? "yes" : "NO");
+    char from[PIPE_KEY];
+    pipe_key(from, fn->name, 0.0);
+    printf("first rows at x >= 0:\n");
+    size_t shown = 0;
+    PatrieCursor *c = patrie_cursor_open(root, from, 1);
+    const char *token;
+    Phenotype p;
+    while (shown < 3 && patrie_cursor_next(c, &token, &p)) { pipe_print(token, &p, NULL); ++shown; }
+    patrie_cursor_close(c);
+
+    trie_free(serial);
+    trie_free(root);
+    return same ? 0 : 1;
+}